@@ -0,0 +1,54 @@
+import os
+import sys
+import time
+from os.path import isfile
+
+from test_flattener import input_types, output_dir, simplified_prefix
+
+# grounding time of opt_flatten with the join kernels and with
+# --generic-join, on the simplified games test_flattener.py leaves in
+# its output dir, or on reprinted rule files given as arguments
+REPETITIONS = 3
+FLATTEN = "./rule_engine/opt_flatten"
+variants = [
+    ('kernels', ''),
+    ('generic', '--generic-join'),
+]
+
+
+def best_seconds(cmd_s):
+    best = None
+    for _ in range(REPETITIONS):
+        started = time.time()
+        if os.system(cmd_s):
+            raise Exception("Command:\n%s\nfailed." % cmd_s)
+        seconds = time.time() - started
+        if best is None or seconds < best:
+            best = seconds
+    return best
+
+
+def main():
+    if len(sys.argv) > 1:
+        games = sys.argv[1:]
+    else:
+        games = [name for name, _ in input_types]
+    print "%-40s %10s %10s" % ("game", "kernels", "generic")
+    for game in games:
+        inpf = game
+        if not isfile(inpf):
+            inpf = output_dir + simplified_prefix + game + '.kif'
+        if not isfile(inpf):
+            print "%-40s skipped, run test_flattener.py %s first" % (game, game)
+            continue
+        times = []
+        for variant, args in variants:
+            out_flat = "/tmp/benchmark_%s_%s" % (variant, os.path.basename(inpf))
+            times.append(best_seconds("%s %s %s %s > /dev/null 2>&1" % (
+                FLATTEN, inpf, out_flat, args)))
+            os.remove(out_flat)
+        print "%-40s %9.3fs %9.3fs" % (game, times[0], times[1])
+
+
+if __name__ == '__main__':
+    main()
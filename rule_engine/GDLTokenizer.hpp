@@ -3,9 +3,13 @@
 #include <cctype>
 #include <fstream>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <string>
 
 using namespace std;
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
 
 struct GDLToken {
     string val;
@@ -75,6 +79,154 @@ struct GDLToken {
     }
 };
 
+// Tokens of one input in a single array, without a string per token:
+// names are offset and length in input and the items of a list are
+// linked by index. A list of one item stands for that item, as after
+// GDLToken::shorten_edges, so readers go through item() for every child.
+// Nodes and input keep their memory between tokenize_str calls.
+struct FlatGDLTokens {
+    struct Node {
+        int first_child; // -1 for names and empty lists
+        int next_sibling; // -1 for the last item of a list
+        int children_n;
+        uint32_t offset, length; // of the name in input
+    };
+    string input;
+    vector<Node> nodes; // nodes[0] is the list of everything in input
+    vector<int> open_lists; // the tokenizer's stack of (list, last item)
+
+    void tokenize_str(const string &_input) {
+        input = _input;
+        tokenize();
+    }
+
+    void tokenize() {
+        assert(input.size() < UINT32_MAX);
+        nodes.resize(0);
+        open_lists.resize(0);
+        nodes.push_back(Node{-1, -1, 0, 0, 0});
+        open_lists.push_back(0);
+        open_lists.push_back(-1);
+        size_t c = 0;
+        while (c < input.size()) {
+            const char cur = input[c];
+            if (cur == ')') {
+                // unbalanced input isn't accepted by GDLTokenizer either
+                assert(open_lists.size() > 2);
+                open_lists.resize(open_lists.size() - 2);
+                ++c;
+                continue;
+            }
+            if (isspace(cur)) {
+                ++c;
+                continue;
+            }
+            const int node = nodes.size();
+            if (cur == '(') {
+                nodes.push_back(Node{-1, -1, 0, (uint32_t)c, 0});
+                ++c;
+            } else {
+                const size_t s = c;
+                while (c < input.size() && !isspace(input[c]) && input[c] != '(' && input[c] != ')') {
+                    ++c;
+                }
+                nodes.push_back(Node{-1, -1, 0, (uint32_t)s, (uint32_t)(c - s)});
+            }
+            Node &parent = nodes[open_lists[open_lists.size() - 2]];
+            int &last = open_lists.back();
+            if (last == -1) {
+                parent.first_child = node;
+            } else {
+                nodes[last].next_sibling = node;
+            }
+            ++parent.children_n;
+            last = node;
+            if (cur == '(') {
+                open_lists.push_back(node);
+                open_lists.push_back(-1);
+            }
+        }
+    }
+
+    // node, or the item it stands for if it is a list of one
+    int item(int node) const {
+        while (nodes[node].children_n == 1) {
+            node = nodes[node].first_child;
+        }
+        return node;
+    }
+
+    int root() const {
+        return item(0);
+    }
+
+    // names and empty lists
+    bool leaf(int node) const {
+        return nodes[node].children_n == 0;
+    }
+
+    // text of a leaf, empty for an empty list (lists have length 0)
+    string name(int node) const {
+        return input.substr(nodes[node].offset, nodes[node].length);
+    }
+
+    bool name_is(int node, const string &s) const {
+        const Node &n = nodes[node];
+        return leaf(node) && n.length == s.size() && input.compare(n.offset, n.length, s) == 0;
+    }
+
+    // the same text as GDLToken::to_nice_string of the root
+    void append_nice_string(string &res) const {
+        const int top = root();
+        if (leaf(top)) {
+            assert(nodes[top].length > 0);
+            res += "( ";
+            res.append(input, nodes[top].offset, nodes[top].length);
+            res += " )";
+            return;
+        }
+        // every top level rule is presented as a theorem
+        const bool theorem = name_is(item(nodes[top].first_child), "<=");
+        if (!theorem) {
+            res += "( <= ";
+        }
+        append_list(res, top);
+        if (!theorem) {
+            res += " )";
+        }
+    }
+
+    // compatibility with code taking GDLToken trees
+    void to_token(int node, GDLToken &res) const {
+        res.sub.resize(0);
+        if (leaf(node)) {
+            res.val = name(node);
+            return;
+        }
+        res.val.clear();
+        res.sub.resize(nodes[node].children_n);
+        int i = 0;
+        for (int child = nodes[node].first_child; child != -1; child = nodes[child].next_sibling) {
+            to_token(item(child), res.sub[i++]);
+        }
+    }
+
+private:
+    void append_list(string &res, int node) const {
+        res += "(";
+        for (int child = nodes[node].first_child; child != -1; child = nodes[child].next_sibling) {
+            const int sub = item(child);
+            res += ' ';
+            if (leaf(sub)) {
+                res.append(input, nodes[sub].offset, nodes[sub].length);
+            } else {
+                append_list(res, sub);
+            }
+        }
+        res += " )";
+    }
+};
+
 struct GDLTokenizer {
     string input;
     bool is_whitespace(char c) {
@@ -123,14 +275,27 @@ struct GDLTokenizer {
     }
 
     static void tokenize(const string &input_path, vector<GDLToken> &result) {
-        ifstream inp(input_path);
-        string input = string((istreambuf_iterator<char>(inp)), istreambuf_iterator<char>());
+        FlatGDLTokens tokens;
+        {
+            const MappedFile file(input_path);
+            tokens.input.assign(file.data, file.size);
+        }
+        tokens.tokenize();
         GDLToken root;
-        tokenize_str(input, root);
-        result = root.sub;
+        tokens.to_token(tokens.root(), root);
+        result.swap(root.sub);
     }
     
+    // by FlatGDLTokens, the tree is built once with short edges already
     static void tokenize_str(const string &input, GDLToken &result) {
+        static thread_local FlatGDLTokens tokens;
+        tokens.tokenize_str(input);
+        tokens.to_token(tokens.root(), result);
+    }
+
+    // the recursive tokenizer with a string per token, kept as the
+    // reference for tokenizer_bench
+    static void tokenize_str_by_tree(const string &input, GDLToken &result) {
         GDLTokenizer gdl_tokenizer;
         gdl_tokenizer.input = input;
         result.sub.resize(0);
@@ -139,13 +304,29 @@ struct GDLTokenizer {
         result.shorten_edges();
     }
 
-    // works assuming that ther is one rule per line in file
-    static void optimized_tokenize(const string &input_path, vector<GDLToken> &result) {
-        ifstream inp(input_path);
-        string line;
-        while (getline(inp, line)) {
-            result.push_back(GDLToken());
-            tokenize_str(line, result.back());
+    // works assuming that ther is one rule per line in file, the file is
+    // mapped and its chunks are tokenized on threads_n threads
+    static void optimized_tokenize(const string &input_path, vector<GDLToken> &result,
+            int threads_n = 1) {
+        const size_t CHUNK_BYTES = 1 << 20;
+        const MappedFile file(input_path);
+        const auto bounds = line_chunk_bounds(file, CHUNK_BYTES);
+        vector<vector<GDLToken>> chunk_tokens(bounds.size() - 1);
+        ThreadPool pool(threads_n);
+        pool.run(chunk_tokens.size(), [&](int chunk, int) {
+            FlatGDLTokens tokens;
+            for_each_line(file.data + bounds[chunk], file.data + bounds[chunk + 1],
+                    [&](const char *line, size_t length) {
+                tokens.input.assign(line, length);
+                tokens.tokenize();
+                chunk_tokens[chunk].emplace_back();
+                tokens.to_token(tokens.root(), chunk_tokens[chunk].back());
+            });
+        });
+        for (auto &tokens: chunk_tokens) {
+            for (auto &token: tokens) {
+                result.push_back(move(token));
+            }
         }
     }
 };
@@ -290,13 +290,16 @@ void HighNode::fill_key_occurences(AlignmentVarInfo &var_info) const {
                 return va.sentence < vb.sentence;
             });
     var_info.key_occurences = var_info.occurences;
-    auto last = unique(var_info.key_occurences.begin(), var_info.key_occurences.end());
+    auto last = unique(var_info.key_occurences.begin(), var_info.key_occurences.end(),
+            [](const VarOccurence &va, const VarOccurence &vb) -> bool {
+                return va.sentence == vb.sentence;
+            });
     while (&var_info.key_occurences.back() + 1 != last) {
         var_info.key_occurences.pop();
     }
 }
 
-void HighNode::fill_var_equivalence(AlignmentInfo &ai) const {
+void HighNode::fill_var_equivalence(AlignmentInfoBuilder &ai) const {
     ai.var_equivalence.resize(ai.source_sentences.size);
     for (size_t sentence_i = 0; sentence_i < ai.source_sentences.size; ++sentence_i) {
         ai.var_equivalence[sentence_i].resize(
@@ -323,7 +326,7 @@ void HighNode::fill_var_equivalence(AlignmentInfo &ai) const {
 
 AlignmentInfo HighNode::alignment_info() const {
     assert(type == TYPE::THEOREM);
-    AlignmentInfo res;
+    AlignmentInfoBuilder res;
     res.destination_theorem = domain_map[domain_hash];
     res.destination_sentence = domain_map[sub[0].domain_hash];
     res.sources_new_valuations_n = 1;
@@ -343,6 +346,7 @@ AlignmentInfo HighNode::alignment_info() const {
         } else if (sub_svalue != "not") {
             res.source_sentences.append(domain_map[sub[i].domain_hash]);
             assert(res.source_sentences.back());
+            res.source_watermarks.append(0);
             res.sources_new_valuations_n += domain_map[sub[i].domain_hash]->valuations.size();
             res.source_constraints.grow();
             sub[i].fill_var_constraints(res.source_constraints.back());
@@ -365,6 +369,21 @@ AlignmentInfo HighNode::alignment_info() const {
         fill_key_occurences(vi);
     }
     fill_var_equivalence(res);
-    return res;
+    return AlignmentInfo(res);
 }
 
+// negated sentences are parsed as tuples or constants without domains,
+// so their domain comes from the pattern of the not
+size_t body_domain_hash(const HighNode &literal) {
+    if (reverse_numeric_rename[literal.value] != "not") {
+        return literal.domain_hash;
+    }
+    assert(literal.sub.size() == 1);
+    const HighNode &negated = literal.sub[0];
+    if (negated.type == TYPE::CONST) {
+        return str_hasher(reverse_numeric_rename[negated.value]);
+    }
+    const string &pattern = literal.domain_pattern;
+    assert(pattern.substr(0, 6) == "not ( " && pattern.substr(pattern.size() - 2) == " )");
+    return str_hasher(pattern.substr(6, pattern.size() - 8));
+}
@@ -71,6 +71,9 @@ struct HighNode {
             int &var_index) const;
     void fill_var_in_dom_indices(LimitedArray<int, MAX_DOMAIN_VARS> &to_fill) const;
     void fill_key_occurences(AlignmentVarInfo &var_info) const;
-    void fill_var_equivalence(AlignmentInfo &ai) const;
+    void fill_var_equivalence(AlignmentInfoBuilder &ai) const;
     AlignmentInfo alignment_info() const;
 };
+
+// domain of a body literal, for a not it is the domain of the negated sentence
+size_t body_domain_hash(const HighNode &literal);
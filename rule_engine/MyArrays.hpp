@@ -1,6 +1,8 @@
 #pragma once
 #include <cassert>
 #include <algorithm>
+#include <vector>
+#include <memory>
 
 template <typename T>
 struct SizedArray {
@@ -245,3 +247,202 @@ struct LimitedArray: public SizedArray<T> {
         return false;
     }
 };
+
+// Stack which grows by whole chunks, elements never move, so references to
+// them stay valid while it grows. Chunks stay allocated after resize(0).
+template <typename T, size_t CHUNK_SIZE = 1024>
+struct ChunkedStack {
+    std::vector<std::unique_ptr<T[]>> chunks;
+    size_t size;
+
+    ChunkedStack() {
+        size = 0;
+    }
+
+    T &operator[](size_t i) {
+        assert(i < size);
+        return chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+    }
+
+    const T &operator[](size_t i) const {
+        assert(i < size);
+        return chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+    }
+
+    T &back() {
+        return (*this)[size - 1];
+    }
+
+    // new elements are default constructed, like in LimitedArray
+    void resize(size_t new_size) {
+        while (chunks.size() * CHUNK_SIZE < new_size) {
+            chunks.emplace_back(new T[CHUNK_SIZE]);
+        }
+        for (size_t i = size; i < new_size; ++i) {
+            T &item = chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+            item.~T();
+            new (&item) T();
+        }
+        size = new_size;
+    }
+
+    void grow() {
+        resize(size + 1);
+    }
+
+    size_t capacity() const {
+        return chunks.size() * CHUNK_SIZE;
+    }
+
+    void pop() {
+        assert(size > 0);
+        --size;
+    }
+};
+
+// Bump allocator of arrays of T in chunks which never move. reset() makes
+// all memory reusable, the chunks are kept.
+template <typename T, size_t CHUNK_SIZE = (1 << 16)>
+struct Arena {
+    std::vector<std::vector<T>> chunks;
+    size_t chunk_i;
+    size_t used; // in chunks[chunk_i]
+
+    Arena() {
+        chunk_i = 0;
+        used = 0;
+    }
+
+    T *allocate(size_t n) {
+        while (chunk_i < chunks.size() && chunks[chunk_i].size() - used < n) {
+            ++chunk_i;
+            used = 0;
+        }
+        if (chunk_i == chunks.size()) {
+            chunks.emplace_back(std::max(n, CHUNK_SIZE));
+            used = 0;
+        }
+        T *res = chunks[chunk_i].data() + used;
+        used += n;
+        return res;
+    }
+
+    void reset() {
+        chunk_i = 0;
+        used = 0;
+    }
+
+    size_t capacity() const {
+        size_t res = 0;
+        for (const auto &chunk: chunks) {
+            res += chunk.size();
+        }
+        return res;
+    }
+};
+
+// Read-only view of one row of FlatRows.
+template <typename T>
+struct RowView {
+    const T *items;
+    size_t size;
+
+    RowView(const T *_items, size_t _size) {
+        items = _items;
+        size = _size;
+    }
+
+    const T &operator[](size_t i) const {
+        assert(i < size);
+        return items[i];
+    }
+
+    const T *begin() const {
+        return items;
+    }
+
+    const T *end() const {
+        return items + size;
+    }
+
+    bool operator==(const RowView<T> &rv) const {
+        return size == rv.size && std::equal(begin(), end(), rv.begin());
+    }
+
+    bool operator!=(const RowView<T> &rv) const {
+        return !(*this == rv);
+    }
+
+    bool operator<(const RowView<T> &rv) const {
+        return std::lexicographical_compare(begin(), end(), rv.begin(), rv.end());
+    }
+};
+
+// Rows of the same width stored one after another in a single array.
+template <typename T>
+struct FlatRows {
+    size_t width;
+    size_t rows_n;
+    std::vector<T> items;
+
+    FlatRows(size_t _width = 0) {
+        width = _width;
+        rows_n = 0;
+    }
+
+    size_t size() const {
+        return rows_n;
+    }
+
+    RowView<T> operator[](size_t i) const {
+        assert(i < rows_n);
+        return RowView<T>(items.data() + i * width, width);
+    }
+
+    RowView<T> at(size_t i) const {
+        return (*this)[i];
+    }
+
+    // returns the new row to be filled
+    T *append_row() {
+        items.resize(items.size() + width);
+        return items.data() + (rows_n++) * width;
+    }
+
+    // row can't be a view into this
+    template <typename Row>
+    void push_back(const Row &row) {
+        assert(row.size == width);
+        std::copy(row.begin(), row.end(), append_row());
+    }
+
+    void pop_back() {
+        assert(rows_n > 0);
+        --rows_n;
+        items.resize(rows_n * width);
+    }
+
+    void reset(size_t _width) {
+        width = _width;
+        rows_n = 0;
+        items.clear();
+    }
+
+    // keeps only first new_width columns of every row
+    void narrow(size_t new_width) {
+        assert(new_width <= width);
+        if (new_width == width) return;
+        for (size_t row = 0; row < rows_n; ++row) {
+            std::copy(items.begin() + row * width, items.begin() + row * width + new_width,
+                    items.begin() + row * new_width);
+        }
+        items.resize(rows_n * new_width);
+        width = new_width;
+    }
+
+    void swap(FlatRows<T> &other) {
+        std::swap(width, other.width);
+        std::swap(rows_n, other.rows_n);
+        items.swap(other.items);
+    }
+};
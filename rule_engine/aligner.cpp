@@ -1,96 +1,1025 @@
 #include "aligner.hpp"
 #include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <unistd.h>
+#include "thread_pool.hpp"
+#include "join_kernels.hpp"
 
-static _Aligner ali;
-
-template<typename T>
-static void uniquefy(vector<T> &v) {
-    sort(v.begin(), v.end());
-    auto last = unique(v.begin(), v.end());
-    v.erase(last, v.end());
-}
-
-void fix_point_align(vector<AlignmentInfo> &to_align) {
-   int theorem_valuations_found = 0;
-   int sentence_valuations_found = 0;
-   while ("Elvis Lives") {
-       size_t to_be_processed_index = 0;
-       for (size_t i = 0; i < to_align.size(); ++i) {
-           if (to_align[i].sources_new_valuations_n > 
-               to_align[to_be_processed_index].sources_new_valuations_n) {
-               to_be_processed_index = i;
-           }
-       }
-       if (to_align[to_be_processed_index].sources_new_valuations_n == 0) {
-           break;
-       }
-       AlignmentInfo &to_be_processed = to_align[to_be_processed_index];
-
-       Domain &sentence = *to_be_processed.destination_sentence;
-       Domain &theorem = *to_be_processed.destination_theorem;
-       cerr << "doing: " << theorem.pattern << endl;
-
-       ali.find_valuations(&to_be_processed);
-       cerr << "valuations found: " << ali.new_valuations.size() << endl;
-       auto &tv = theorem.valuations;
-       int old_tvaluations_n = tv.size();
-       tv.insert(tv.end(), 
-            ali.new_valuations.begin(), ali.new_valuations.end());
-       uniquefy(tv);
-       theorem_valuations_found += tv.size() - old_tvaluations_n;
-       auto &sv = sentence.valuations;
-       int old_svaluations_n = sv.size();
-       for (auto &new_valuation: ali.new_valuations) {
-           new_valuation.resize(sentence.valuation_size);
-           sv.push_back(new_valuation);
-       }
-       uniquefy(sv);
-       to_be_processed.sources_new_valuations_n = 0;
-       int svaluations_n_delta = sv.size() - old_svaluations_n;
-       sentence_valuations_found += svaluations_n_delta;
-       //cerr << "new valuations n: " << valuations_n_delta << endl;
-       if (sentence_valuations_found % 100 == 0) cerr << "sv: " << sentence_valuations_found << endl;
-       if (theorem_valuations_found % 100 == 0)  cerr << "tv: " << theorem_valuations_found << endl;
-      // cerr << "resulting theorem valuations: \n" << theorem.to_full_string() << endl;
-       //cerr << "resulting domain valuations: \n" << sentence.to_full_string() << endl;
-       for (auto &ai: to_align) {
-           if (ai.source_sentences.contains(&sentence)) {
-               ai.sources_new_valuations_n += svaluations_n_delta;
-           }
-       }
-   }
+// returns place for n items of type T at offset, aligned;
+// with no base only moves offset to count the bytes needed
+template <typename T>
+static T *carve(char *base, size_t &offset, size_t n) {
+    offset = (offset + alignof(T) - 1) / alignof(T) * alignof(T);
+    T *res = base ? reinterpret_cast<T*>(base + offset) : 0;
+    offset += n * sizeof(T);
+    return res;
+}
+
+template <typename T, typename Array>
+static void pack_array(SizedArray<T> &view, const Array &from, char *base, size_t &offset) {
+    T *items = carve<T>(base, offset, from.size);
+    if (!base) return;
+    for (size_t i = 0; i < from.size; ++i) {
+        new (&items[i]) T(from[i]);
+    }
+    view.set_items(items, from.size);
+}
+
+template <typename T>
+static SizedArray<T> *carve_views(SizedArray<SizedArray<T>> &view, size_t n, char *base, size_t &offset) {
+    SizedArray<T> *items = carve<SizedArray<T>>(base, offset, n);
+    if (!base) return 0;
+    for (size_t i = 0; i < n; ++i) {
+        new (&items[i]) SizedArray<T>();
+    }
+    view.set_items(items, n);
+    return items;
+}
+
+template <typename Source>
+void AlignmentInfo::layout(const Source &source, char *base, size_t &offset) {
+    SizedArray<VarConstraint> no_constraints;
+    SizedArray<VarOccurence> no_occurences;
+    SizedArray<int> no_ints;
+    pack_array(source_sentences, source.source_sentences, base, offset);
+    pack_array(binding_order, source.binding_order, base, offset);
+    pack_array(domain_filling_pattern, source.domain_filling_pattern, base, offset);
+    pack_array(source_watermarks, source.source_watermarks, base, offset);
+
+    auto *constraints = carve_views(source_constraints, source.source_constraints.size, base, offset);
+    for (size_t i = 0; i < source.source_constraints.size; ++i) {
+        pack_array(base ? constraints[i] : no_constraints, source.source_constraints[i], base, offset);
+    }
+    auto *equivalences = carve_views(var_equivalence, source.var_equivalence.size, base, offset);
+    for (size_t i = 0; i < source.var_equivalence.size; ++i) {
+        pack_array(base ? equivalences[i] : no_ints, source.var_equivalence[i], base, offset);
+    }
+
+    CompactVarInfo *infos = carve<CompactVarInfo>(base, offset, source.var_infos.size);
+    if (base) {
+        for (size_t i = 0; i < source.var_infos.size; ++i) {
+            new (&infos[i]) CompactVarInfo();
+        }
+        var_infos.set_items(infos, source.var_infos.size);
+    }
+    for (size_t i = 0; i < source.var_infos.size; ++i) {
+        const auto &from = source.var_infos[i];
+        pack_array(base ? infos[i].occurences : no_occurences, from.occurences, base, offset);
+        pack_array(base ? infos[i].key_occurences : no_occurences, from.key_occurences, base, offset);
+        pack_array(base ? infos[i].different_than : no_ints, from.different_than, base, offset);
+        pack_array(base ? infos[i].different_than_const : no_ints,
+                from.different_than_const, base, offset);
+    }
+}
+
+template <typename Source>
+void AlignmentInfo::pack(const Source &source) {
+    destination_theorem = source.destination_theorem;
+    destination_sentence = source.destination_sentence;
+    sources_new_valuations_n = source.sources_new_valuations_n;
+    size_t bytes = 0;
+    layout(source, 0, bytes);
+    buffer.reset(new long long[(bytes + sizeof(long long) - 1) / sizeof(long long)]);
+    buffer_bytes = bytes;
+    size_t offset = 0;
+    layout(source, reinterpret_cast<char*>(buffer.get()), offset);
+    assert(offset == bytes);
+}
+
+// views of other point into its buffer, which this has just taken over
+void AlignmentInfo::take_views(const AlignmentInfo &other) {
+    destination_theorem = other.destination_theorem;
+    destination_sentence = other.destination_sentence;
+    sources_new_valuations_n = other.sources_new_valuations_n;
+    source_sentences.set_items(other.source_sentences.items, other.source_sentences.size);
+    source_constraints.set_items(other.source_constraints.items, other.source_constraints.size);
+    var_infos.set_items(other.var_infos.items, other.var_infos.size);
+    binding_order.set_items(other.binding_order.items, other.binding_order.size);
+    domain_filling_pattern.set_items(
+            other.domain_filling_pattern.items, other.domain_filling_pattern.size);
+    var_equivalence.set_items(other.var_equivalence.items, other.var_equivalence.size);
+    source_watermarks.set_items(other.source_watermarks.items, other.source_watermarks.size);
+}
+
+AlignmentInfo::AlignmentInfo() {
+    destination_theorem = destination_sentence = 0;
+    sources_new_valuations_n = 0;
+    buffer_bytes = 0;
+}
+
+AlignmentInfo::AlignmentInfo(const AlignmentInfoBuilder &builder) {
+    pack(builder);
+}
+
+AlignmentInfo::AlignmentInfo(const AlignmentInfo &other) {
+    pack(other);
+}
+
+AlignmentInfo::AlignmentInfo(AlignmentInfo &&other) noexcept {
+    buffer_bytes = other.buffer_bytes;
+    buffer = move(other.buffer);
+    take_views(other);
+}
+
+AlignmentInfo &AlignmentInfo::operator=(const AlignmentInfo &other) {
+    if (this != &other) {
+        pack(other);
+    }
+    return *this;
+}
+
+AlignmentInfo &AlignmentInfo::operator=(AlignmentInfo &&other) noexcept {
+    if (this != &other) {
+        buffer_bytes = other.buffer_bytes;
+        buffer = move(other.buffer);
+        take_views(other);
+    }
+    return *this;
+}
+
+size_t Domain::valuation_hash(int vi) const {
+    // FNV-1a
+    unsigned long long res = 14695981039346656037ULL;
+    for (short symbol: valuations[vi]) {
+        res ^= (unsigned short)symbol;
+        res *= 1099511628211ULL;
+    }
+    return res ^ (res >> 32);
+}
+
+// inserts vi unless an equal valuation is there already
+bool Domain::insert_membership(int vi) {
+    const size_t mask = membership.size() - 1;
+    size_t slot = valuation_hash(vi) & mask;
+    while (membership[slot] != -1) {
+        if (valuations[membership[slot]] == valuations[vi]) {
+            return false;
+        }
+        slot = (slot + 1) & mask;
+    }
+    membership[slot] = vi;
+    return true;
+}
+
+size_t Domain::memory_bytes() const {
+    size_t res = sizeof(Domain) + valuations.items.capacity() * sizeof(short)
+        + membership.capacity() * sizeof(int);
+    for (const auto &index: column_indexes) {
+        res += index.capacity() * sizeof(int);
+    }
+    return res;
+}
+
+void Domain::rehash_membership(size_t slots_n) {
+    membership.assign(slots_n, -1);
+    for (size_t vi = 0; vi < valuations.size(); ++vi) {
+        insert_membership(vi);
+    }
+}
+
+int Domain::add_valuations(const ValuationRows &to_add) {
+    assert(to_add.width == (size_t)valuation_size);
+    int added_n = 0;
+    for (size_t i = 0; i < to_add.size(); ++i) {
+        // at most half full, counting the candidate
+        if ((valuations.size() + 1) * 2 > membership.size()) {
+            rehash_membership(max((size_t)16, membership.size() * 2));
+        }
+        valuations.push_back(to_add[i]);
+        if (insert_membership(valuations.size() - 1)) {
+            ++added_n;
+        } else {
+            valuations.pop_back();
+        }
+    }
+    return added_n;
+}
+
+void Domain::replace_valuations(const ValuationRows &new_valuations) {
+    valuations.reset(valuation_size);
+    membership.clear();
+    column_indexes.clear();
+    column_indexed_n.clear();
+    column_distinct_n.clear();
+    add_valuations(new_valuations);
+}
+
+vector<int> Domain::sorted_order() const {
+    vector<int> res(valuations.size());
+    for (size_t vi = 0; vi < res.size(); ++vi) {
+        res[vi] = vi;
+    }
+    sort(res.begin(), res.end(), [this](int a, int b) -> bool {
+        return valuations[a] < valuations[b];
+    });
+    return res;
+}
+
+const vector<int> &Domain::column_index(int column) {
+    lock_guard<mutex> guard(lock);
+    if (column_indexes.empty()) {
+        column_indexes.resize(valuation_size);
+        column_indexed_n.assign(valuation_size, 0);
+    }
+    auto &index = column_indexes[column];
+    if (column_indexed_n[column] == (int)valuations.size()) {
+        return index;
+    }
+    auto by_column = [this, column](int a, int b) -> bool {
+        const int value_a = valuations[a][column];
+        const int value_b = valuations[b][column];
+        return value_a < value_b || (value_a == value_b && a < b);
+    };
+    const size_t old_size = index.size();
+    for (size_t vi = column_indexed_n[column]; vi < valuations.size(); ++vi) {
+        index.push_back(vi);
+    }
+    sort(index.begin() + old_size, index.end(), by_column);
+    inplace_merge(index.begin(), index.begin() + old_size, index.end(), by_column);
+    column_indexed_n[column] = valuations.size();
+    column_distinct_n.resize(valuation_size);
+    column_distinct_n[column] = 0;
+    for (size_t i = 0; i < index.size(); ++i) {
+        if (i == 0 || valuations[index[i]][column] != valuations[index[i - 1]][column]) {
+            ++column_distinct_n[column];
+        }
+    }
+    return index;
+}
+
+int Domain::distinct_values(int column) {
+    column_index(column);
+    lock_guard<mutex> guard(lock);
+    return column_distinct_n[column];
+}
+
+void JoinProfile::add(const JoinProfile &other) {
+    runs += other.runs;
+    passes += other.passes;
+    stack_passes += other.stack_passes;
+    rows_consumed += other.rows_consumed;
+    rows_produced += other.rows_produced;
+    theorem_duplicates += other.theorem_duplicates;
+    sentence_duplicates += other.sentence_duplicates;
+    peak_bounds_stack = max(peak_bounds_stack, other.peak_bounds_stack);
+    prepare_seconds += other.prepare_seconds;
+    join_seconds += other.join_seconds;
+    add_seconds += other.add_seconds;
+}
+
+static double seconds_since(chrono::steady_clock::time_point started) {
+    return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+}
+
+size_t _Aligner::memory_bytes() const {
+    return sizeof(_Aligner) + new_valuations.items.capacity() * sizeof(short)
+        + indices_arena.capacity() * sizeof(int)
+        + bounds_stack.capacity() * sizeof(IndexBound);
+}
+
+void _Aligner::find_valuations(const AlignmentInfo *_ai) {
+    initialize(_ai);
+    if (profiling) {
+        profile = JoinProfile();
+        profile.runs = 1;
+    }
+    if (sentences_n() == 0) {
+        const_only_filler();
+        profile.rows_produced = new_valuations.size();
+        return;
+    }
+    // semi-naive evaluation: pass p joins sources before p in full,
+    // only new valuations of source p and only old valuations of sources after p
+    for (int pivot = 0; pivot < sentences_n(); ++pivot) {
+        if (ai->source_watermarks[pivot] == source_sizes[pivot]) continue;
+        source_ranges.resize(0);
+        bool empty = false;
+        for (int sentence_i = 0; sentence_i < sentences_n(); ++sentence_i) {
+            auto range = make_pair(0, source_sizes[sentence_i]);
+            if (sentence_i == pivot) {
+                range.first = ai->source_watermarks[sentence_i];
+            } else if (sentence_i > pivot) {
+                range.second = ai->source_watermarks[sentence_i];
+            }
+            empty = empty || range.first == range.second;
+            source_ranges.append(range);
+        }
+        if (empty) continue;
+        const auto started = chrono::steady_clock::now();
+        const double prepare_seconds = profile.prepare_seconds;
+        start_pass();
+        plan_binding_order();
+        const JoinKernel kernel = generic_join ?
+            nullptr : split_kernel(sentences_n(), vars_n());
+        if (join_engine == JOIN_ENGINE::TRIE) {
+            trie_compute();
+        } else if (kernel) {
+            kernel(*this);
+        } else {
+            compute();
+        }
+        if (log_plans) {
+            log_pass(pivot);
+        }
+        if (profiling) {
+            ++profile.passes;
+            for (const auto &range: source_ranges) {
+                profile.rows_consumed += range.second - range.first;
+            }
+            profile.join_seconds += seconds_since(started)
+                - (profile.prepare_seconds - prepare_seconds);
+        }
+    }
+    profile.rows_produced = new_valuations.size();
+}
+
+// Tarjan's strongly connected components of the graph
+// source domain -> destination sentence domain
+struct DomainGraph {
+    unordered_map<const Domain*, int> node_ids;
+    vector<vector<int>> edges;
+    vector<int> order, lowlink, stack;
+    vector<bool> on_stack;
+    vector<int> component;
+    int components_n;
+
+    int node(const Domain *domain) {
+        auto it = node_ids.find(domain);
+        if (it != node_ids.end()) {
+            return it->second;
+        }
+        const int id = edges.size();
+        node_ids[domain] = id;
+        edges.push_back(vector<int>());
+        return id;
+    }
+
+    void visit(int v, int &counter) {
+        order[v] = lowlink[v] = counter++;
+        stack.push_back(v);
+        on_stack[v] = true;
+        for (int u: edges[v]) {
+            if (order[u] == -1) {
+                visit(u, counter);
+                lowlink[v] = min(lowlink[v], lowlink[u]);
+            } else if (on_stack[u]) {
+                lowlink[v] = min(lowlink[v], order[u]);
+            }
+        }
+        if (lowlink[v] == order[v]) {
+            while (true) {
+                const int u = stack.back();
+                stack.pop_back();
+                on_stack[u] = false;
+                component[u] = components_n;
+                if (u == v) break;
+            }
+            ++components_n;
+        }
+    }
+
+    // components are numbered in reverse topological order
+    void find_components() {
+        const int n = edges.size();
+        order.assign(n, -1);
+        lowlink.assign(n, -1);
+        on_stack.assign(n, false);
+        component.assign(n, -1);
+        components_n = 0;
+        int counter = 0;
+        for (int v = 0; v < n; ++v) {
+            if (order[v] == -1) {
+                visit(v, counter);
+            }
+        }
+    }
+};
+
+// groups alignment infos by the component of their destination sentence,
+// strata go in topological order, so every stratum depends only on itself
+// and on strata before it
+static vector<vector<int>> stratify(const vector<AlignmentInfo> &to_align) {
+    DomainGraph graph;
+    for (const auto &ai: to_align) {
+        const int destination = graph.node(ai.destination_sentence);
+        for (const Domain *source: ai.source_sentences) {
+            const int source_node = graph.node(source);
+            graph.edges[source_node].push_back(destination);
+        }
+    }
+    graph.find_components();
+    vector<vector<int>> strata(graph.components_n);
+    for (size_t ai_i = 0; ai_i < to_align.size(); ++ai_i) {
+        const int component = graph.component[graph.node(to_align[ai_i].destination_sentence)];
+        strata[graph.components_n - 1 - component].push_back(ai_i);
+    }
+    strata.erase(remove_if(strata.begin(), strata.end(),
+                [](const vector<int> &stratum) { return stratum.empty(); }),
+            strata.end());
+    return strata;
+}
+
+// Greedy planner: the next var is the one with the fewest expected values
+// given the vars bound so far. A source restricted by its bound columns is
+// expected to have rows / (product of their distinct counts) rows, and it
+// can't give a var more values than that or than the var's column has
+// distinct values. The source giving the fewest values is the main
+// occurence. Without planning the static order gets the same estimates.
+void _Aligner::plan_binding_order() {
+    binding_order.resize(0);
+    main_occurences.resize(vars_n());
+    estimated_bindings.resize(0);
+    actual_bindings.resize(vars_n());
+    for (auto &actual: actual_bindings) {
+        actual = 0;
+    }
+    if (!plan && !log_plans) {
+        for (int var_id: ai->binding_order) {
+            binding_order.append(var_id);
+        }
+        for (auto &main: main_occurences) {
+            main = 0;
+        }
+        return;
+    }
+    LimitedArray<double, MAX_SENTENCES_IN_THEOREM> rows;
+    for (int sentence_i = 0; sentence_i < sentences_n(); ++sentence_i) {
+        Domain &source = *ai->source_sentences[sentence_i];
+        const auto &range = source_ranges[sentence_i];
+        double srows = range.second - range.first;
+        for (const auto &constraint: ai->source_constraints[sentence_i]) {
+            srows /= max(1, source.distinct_values(constraint.index));
+        }
+        rows.append(max(1.0, srows));
+    }
+    LimitedArray<bool, MAX_DOMAIN_VARS> bound;
+    bound.resize(vars_n());
+    for (int var_id = 0; var_id < vars_n(); ++var_id) {
+        bound[var_id] = false;
+    }
+    double bindings = 1;
+    for (int level = 0; level < vars_n(); ++level) {
+        int best_var = -1;
+        double best_values = 0;
+        for (int candidate = 0; candidate < vars_n(); ++candidate) {
+            const int var_id = plan ? candidate : ai->binding_order[level];
+            if (bound[var_id]) continue;
+            const auto &occurences = ai->var_infos[var_id].key_occurences;
+            double values = -1;
+            int main = 0;
+            for (size_t oc_i = 0; oc_i < occurences.size; ++oc_i) {
+                const auto &occurence = occurences[oc_i];
+                Domain &source = *ai->source_sentences[occurence.sentence];
+                double srows = rows[occurence.sentence];
+                for (int bound_var = 0; bound_var < vars_n(); ++bound_var) {
+                    if (!bound[bound_var]) continue;
+                    for (const auto &bound_occurence: ai->var_infos[bound_var].key_occurences) {
+                        if (bound_occurence.sentence == occurence.sentence) {
+                            srows /= max(1, source.distinct_values(bound_occurence.index));
+                        }
+                    }
+                }
+                const double svalues = min(max(1.0, srows),
+                        (double)max(1, source.distinct_values(occurence.index)));
+                if (values < 0 || svalues < values) {
+                    values = svalues;
+                    main = oc_i;
+                }
+            }
+            // ties go to the static order, which prefers vars
+            // with more occurences
+            if (best_var == -1 || values < best_values) {
+                best_var = var_id;
+                best_values = values;
+                main_occurences[var_id] = main;
+            }
+            if (!plan) break;
+        }
+        if (!plan) {
+            main_occurences[best_var] = 0;
+        }
+        bound[best_var] = true;
+        binding_order.append(best_var);
+        bindings *= best_values;
+        estimated_bindings.append(bindings);
+    }
+}
+
+void _Aligner::log_pass(int pivot) {
+    for (size_t level = 0; level < estimated_bindings.size; ++level) {
+        PlannerLogRow row;
+        row.ai = ai;
+        row.pivot = pivot;
+        row.level = level;
+        row.var_id = binding_order[level];
+        row.estimated_bindings = estimated_bindings[level];
+        row.actual_bindings = actual_bindings[level];
+        planner_log.push_back(row);
+    }
+}
+
+// Checkpoint file: magic, number of symbols, then every domain
+// (id, valuation size, rows, items) sorted by id, then every alignment info
+// in to_align order (destination id, new valuations, watermarks).
+// Symbol ids and domain ids only mean the same thing for the same input,
+// the counts and ids are checked on load.
+static const char CHECKPOINT_MAGIC[8] = {'G', 'G', 'P', 'C', 'K', 'P', '0', '1'};
+
+static void write_bytes(FILE *file, const void *data, size_t bytes, const string &path) {
+    if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes) {
+        fclose(file);
+        throw runtime_error("can't write file: " + path);
+    }
+}
+
+template <typename T>
+static void write_value(FILE *file, T value, const string &path) {
+    write_bytes(file, &value, sizeof(T), path);
+}
+
+static void read_bytes(FILE *file, void *data, size_t bytes, const string &path) {
+    if (bytes > 0 && fread(data, 1, bytes, file) != bytes) {
+        fclose(file);
+        throw runtime_error("truncated checkpoint: " + path);
+    }
+}
+
+template <typename T>
+static T read_value(FILE *file, const string &path) {
+    T res;
+    read_bytes(file, &res, sizeof(T), path);
+    return res;
+}
+
+static vector<Domain*> domains_by_id() {
+    vector<Domain*> res;
+    for (const auto &kv: globals().domain_map) {
+        res.push_back(kv.second);
+    }
+    sort(res.begin(), res.end(), [](const Domain *a, const Domain *b) -> bool {
+        return a->id < b->id;
+    });
+    return res;
+}
+
+// written next to the path and renamed over it, so a kill while
+// saving leaves the previous checkpoint intact
+static void save_checkpoint(const string &path, const vector<AlignmentInfo> &to_align) {
+    const string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        throw runtime_error("can't open file: " + tmp_path);
+    }
+    write_bytes(file, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), tmp_path);
+    write_value<uint64_t>(file, globals().reverse_numeric_rename.size(), tmp_path);
+    const auto domains = domains_by_id();
+    write_value<uint64_t>(file, domains.size(), tmp_path);
+    size_t rows_n = 0;
+    for (const Domain *domain: domains) {
+        const auto &valuations = domain->valuations;
+        write_value<uint64_t>(file, domain->id, tmp_path);
+        write_value<int32_t>(file, domain->valuation_size, tmp_path);
+        write_value<uint64_t>(file, valuations.size(), tmp_path);
+        write_bytes(file, valuations.items.data(),
+            valuations.items.size() * sizeof(valuations.items[0]), tmp_path);
+        rows_n += valuations.size();
+    }
+    write_value<uint64_t>(file, to_align.size(), tmp_path);
+    for (const auto &ai: to_align) {
+        write_value<uint64_t>(file, ai.destination_theorem->id, tmp_path);
+        write_value<int32_t>(file, ai.sources_new_valuations_n, tmp_path);
+        write_value<uint32_t>(file, ai.source_watermarks.size, tmp_path);
+        for (int watermark: ai.source_watermarks) {
+            write_value<int32_t>(file, watermark, tmp_path);
+        }
+    }
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        fclose(file);
+        throw runtime_error("can't write file: " + tmp_path);
+    }
+    fclose(file);
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw runtime_error("can't rename " + tmp_path + " to " + path);
+    }
+    cerr << "checkpoint saved: " << domains.size() << " domains, " << rows_n << " valuations" << endl;
+}
+
+// returns false if there is no checkpoint at path
+static bool load_checkpoint(const string &path, vector<AlignmentInfo> &to_align) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    auto mismatch = [file, &path](const string &what) {
+        fclose(file);
+        throw runtime_error("checkpoint " + path + " doesn't match the input: " + what);
+    };
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    read_bytes(file, magic, sizeof(magic), path);
+    if (!equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC)) {
+        fclose(file);
+        throw runtime_error("not a checkpoint: " + path);
+    }
+    if (read_value<uint64_t>(file, path) != globals().reverse_numeric_rename.size()) {
+        mismatch("symbols");
+    }
+    const auto domains = domains_by_id();
+    if (read_value<uint64_t>(file, path) != domains.size()) {
+        mismatch("domains");
+    }
+    size_t rows_n = 0;
+    for (Domain *domain: domains) {
+        if (read_value<uint64_t>(file, path) != domain->id ||
+                read_value<int32_t>(file, path) != domain->valuation_size) {
+            mismatch(domain->pattern);
+        }
+        ValuationRows valuations(domain->valuation_size);
+        valuations.rows_n = read_value<uint64_t>(file, path);
+        valuations.items.resize(valuations.rows_n * valuations.width);
+        read_bytes(file, valuations.items.data(),
+            valuations.items.size() * sizeof(valuations.items[0]), path);
+        // rows keep their positions, the watermarks below refer to them
+        domain->replace_valuations(valuations);
+        assert(domain->valuations.size() == valuations.size());
+        rows_n += valuations.size();
+    }
+    if (read_value<uint64_t>(file, path) != to_align.size()) {
+        mismatch("theorems");
+    }
+    for (auto &ai: to_align) {
+        if (read_value<uint64_t>(file, path) != ai.destination_theorem->id) {
+            mismatch(ai.destination_theorem->pattern);
+        }
+        ai.sources_new_valuations_n = read_value<int32_t>(file, path);
+        if (read_value<uint32_t>(file, path) != ai.source_watermarks.size) {
+            mismatch(ai.destination_theorem->pattern);
+        }
+        for (auto &watermark: ai.source_watermarks) {
+            watermark = read_value<int32_t>(file, path);
+        }
+    }
+    fclose(file);
+    cerr << "checkpoint loaded: " << domains.size() << " domains, " << rows_n << " valuations" << endl;
+    return true;
+}
+
+// one row per theorem, the most expensive first
+static void save_join_profile(const string &path, const vector<AlignmentInfo> &to_align,
+        const vector<JoinProfile> &profiles) {
+    ofstream file(path);
+    if (!file) {
+        throw runtime_error("can't open file: " + path);
+    }
+    auto seconds = [&profiles](int ai_i) {
+        const auto &profile = profiles[ai_i];
+        return profile.prepare_seconds + profile.join_seconds + profile.add_seconds;
+    };
+    vector<int> order(to_align.size());
+    for (size_t ai_i = 0; ai_i < order.size(); ++ai_i) {
+        order[ai_i] = ai_i;
+    }
+    stable_sort(order.begin(), order.end(), [&seconds](int a, int b) -> bool {
+        return seconds(a) > seconds(b);
+    });
+    file << "theorem,sources,runs,passes,rows_consumed,rows_produced,theorem_duplicates,"
+        "sentence_duplicates,peak_bounds_stack,prepare_seconds,join_seconds,add_seconds\n";
+    for (int ai_i: order) {
+        const auto &profile = profiles[ai_i];
+        file << '"' << to_align[ai_i].destination_theorem->pattern << "\","
+            << to_align[ai_i].source_sentences.size << "," << profile.runs << ","
+            << profile.passes << "," << profile.rows_consumed << ","
+            << profile.rows_produced << "," << profile.theorem_duplicates << ","
+            << profile.sentence_duplicates << ",";
+        if (profile.stack_passes > 0) {
+            file << profile.peak_bounds_stack;
+        }
+        file << "," << profile.prepare_seconds << "," << profile.join_seconds << ","
+            << profile.add_seconds << "\n";
+    }
+    cerr << "join profile saved to " << path << endl;
+}
+
+static size_t grounding_memory_bytes(const vector<unique_ptr<_Aligner>> &aligners) {
+    size_t res = 0;
+    for (const auto &kv: globals().domain_map) {
+        res += kv.second->memory_bytes();
+    }
+    for (const auto &ali: aligners) {
+        res += ali->memory_bytes();
+    }
+    return res;
+}
+
+// Lists the largest domains and the theorems whose joins were abandoned,
+// then throws MemoryBudgetExceeded. used - bytes of domains and aligners.
+static void stop_over_budget(size_t budget, size_t used, const vector<const Domain*> &abandoned) {
+    const int LISTED_DOMAINS = 10;
+    cerr << "over memory budget of " << (budget >> 20) << " MB, domains and join buffers take "
+        << (used >> 20) << " MB" << (abandoned.empty() ? "" : " without the abandoned joins") << endl;
+    vector<const Domain*> domains;
+    for (const auto &kv: globals().domain_map) {
+        domains.push_back(kv.second);
+    }
+    vector<size_t> domain_bytes(domains.size());
+    vector<int> order(domains.size());
+    for (size_t i = 0; i < domains.size(); ++i) {
+        domain_bytes[i] = domains[i]->memory_bytes();
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&domain_bytes](int a, int b) -> bool {
+        return domain_bytes[a] > domain_bytes[b];
+    });
+    cerr << "largest domains:" << endl;
+    for (int i = 0; i < min((int)order.size(), LISTED_DOMAINS); ++i) {
+        const Domain *domain = domains[order[i]];
+        cerr << "  " << (domain->type == DTYPE::THEOREM ? "theorem " : "sentence ")
+            << domain->pattern << ": " << domain->valuations.size() << " valuations, "
+            << domain_bytes[order[i]] << " bytes" << endl;
+    }
+    for (const Domain *theorem: abandoned) {
+        cerr << "  join abandoned: " << theorem->pattern << endl;
+    }
+    throw MemoryBudgetExceeded("grounding needs more than " + to_string(budget >> 20) + " MB");
+}
+
+void fix_point_align(vector<AlignmentInfo> &to_align, const AlignOptions &options) {
+    int theorem_valuations_found = 0;
+    int sentence_valuations_found = 0;
+    ThreadPool pool(options.threads_n);
+    // _Aligner is big, so they live on the heap, one per worker
+    vector<unique_ptr<_Aligner>> aligners;
+    for (int worker = 0; worker < pool.size(); ++worker) {
+        aligners.emplace_back(new _Aligner());
+        aligners.back()->join_engine = options.join_engine;
+        aligners.back()->plan = options.plan;
+        aligners.back()->generic_join = options.generic_join;
+        aligners.back()->log_plans = !options.planner_log_path.empty();
+        aligners.back()->profiling = !options.join_profile_path.empty();
+    }
+    const bool profiling = !options.join_profile_path.empty();
+    vector<JoinProfile> profiles(profiling ? to_align.size() : 0);
+    ofstream planner_log;
+    if (!options.planner_log_path.empty()) {
+        planner_log.open(options.planner_log_path);
+        if (!planner_log) {
+            throw runtime_error("can't open file: " + options.planner_log_path);
+        }
+        planner_log << "theorem,pivot,level,var,estimated_bindings,actual_bindings\n";
+    }
+    unordered_map<const Domain*, vector<int>> ais_by_source;
+    for (size_t ai_i = 0; ai_i < to_align.size(); ++ai_i) {
+        const auto &sources = to_align[ai_i].source_sentences;
+        for (size_t source_i = 0; source_i < sources.size; ++source_i) {
+            // once per alignment info, even if the source repeats
+            if (find(sources.begin(), sources.begin() + source_i, sources[source_i])
+                    == sources.begin() + source_i) {
+                ais_by_source[sources[source_i]].push_back(ai_i);
+            }
+        }
+    }
+    if (options.resume && !load_checkpoint(options.checkpoint_path, to_align)) {
+        cerr << "no checkpoint at " << options.checkpoint_path << ", starting from scratch" << endl;
+    }
+    auto last_checkpoint = chrono::steady_clock::now();
+    const auto strata = stratify(to_align);
+    cerr << "strata: " << strata.size() << endl;
+
+    for (const auto &stratum: strata) {
+        while ("Elvis Lives") {
+            vector<int> round;
+            for (int ai_i: stratum) {
+                if (to_align[ai_i].sources_new_valuations_n > 0) {
+                    round.push_back(ai_i);
+                }
+            }
+            if (round.empty()) break;
+
+            if (options.memory_budget > 0) {
+                const size_t used = grounding_memory_bytes(aligners);
+                if (used > options.memory_budget) {
+                    // domains hold whole rounds, the checkpoint resumes here
+                    if (!options.checkpoint_path.empty()) {
+                        save_checkpoint(options.checkpoint_path, to_align);
+                    }
+                    stop_over_budget(options.memory_budget, used, vector<const Domain*>());
+                }
+                // rows a join finds are copied into two domains afterwards
+                for (auto &ali: aligners) {
+                    ali->bytes_limit = max<size_t>(1, (options.memory_budget - used)
+                        / (3 * aligners.size()));
+                }
+            }
+
+            // joins read a snapshot of the domains, nothing is appended
+            // until all of them are done
+            vector<ValuationRows> found(round.size());
+            vector<LimitedArray<int, MAX_SENTENCES_IN_THEOREM>> source_sizes(round.size());
+            vector<JoinProfile> round_profiles(profiling ? round.size() : 0);
+            vector<char> abandoned(round.size(), false);
+            atomic<bool> over_budget(false);
+            pool.run(round.size(), [&](int task, int worker) {
+                // grounding stops after the round, the rest isn't needed
+                if (over_budget) return;
+                _Aligner &ali = *aligners[worker];
+                try {
+                    ali.find_valuations(&to_align[round[task]]);
+                } catch (const _Aligner::RowsLimitReached &) {
+                    abandoned[task] = true;
+                    over_budget = true;
+                    ali.new_valuations.reset(0);
+                    return;
+                }
+                found[task].swap(ali.new_valuations);
+                source_sizes[task] = ali.source_sizes;
+                if (profiling) {
+                    round_profiles[task] = ali.profile;
+                }
+            });
+            if (over_budget) {
+                // nothing of the round was added, so the checkpoint is
+                // consistent and the round runs again after a resume
+                if (!options.checkpoint_path.empty()) {
+                    save_checkpoint(options.checkpoint_path, to_align);
+                }
+                vector<const Domain*> abandoned_theorems;
+                for (size_t task = 0; task < round.size(); ++task) {
+                    if (abandoned[task]) {
+                        abandoned_theorems.push_back(to_align[round[task]].destination_theorem);
+                    }
+                }
+                stop_over_budget(options.memory_budget, grounding_memory_bytes(aligners),
+                    abandoned_theorems);
+            }
+
+            vector<int> theorem_deltas(round.size()), sentence_deltas(round.size());
+            pool.run(round.size(), [&](int task, int) {
+                AlignmentInfo &ai = to_align[round[task]];
+                Domain &theorem = *ai.destination_theorem;
+                Domain &sentence = *ai.destination_sentence;
+                auto &valuations = found[task];
+                // sources may be destinations too, so everything appended
+                // in this round is past the watermarks
+                assert(ai.source_watermarks.size == source_sizes[task].size);
+                for (size_t i = 0; i < ai.source_watermarks.size; ++i) {
+                    ai.source_watermarks[i] = source_sizes[task][i];
+                }
+                ai.sources_new_valuations_n = 0;
+                const auto started = chrono::steady_clock::now();
+                {
+                    lock_guard<mutex> theorem_lock(theorem.lock);
+                    theorem_deltas[task] = theorem.add_valuations(valuations);
+                }
+                valuations.narrow(sentence.valuation_size);
+                {
+                    lock_guard<mutex> sentence_lock(sentence.lock);
+                    sentence_deltas[task] = sentence.add_valuations(valuations);
+                }
+                if (profiling) {
+                    auto &profile = round_profiles[task];
+                    profile.add_seconds = seconds_since(started);
+                    profile.theorem_duplicates = valuations.size() - theorem_deltas[task];
+                    profile.sentence_duplicates = valuations.size() - sentence_deltas[task];
+                }
+            });
+
+            for (size_t task = 0; task < round.size(); ++task) {
+                const AlignmentInfo &ai = to_align[round[task]];
+                cerr << "doing: " << ai.destination_theorem->pattern << endl;
+                cerr << "valuations found: " << found[task].size() << endl;
+                if (profiling) {
+                    profiles[round[task]].add(round_profiles[task]);
+                }
+                theorem_valuations_found += theorem_deltas[task];
+                sentence_valuations_found += sentence_deltas[task];
+                if (sentence_deltas[task] == 0) continue;
+                for (int ai_i: ais_by_source[ai.destination_sentence]) {
+                    to_align[ai_i].sources_new_valuations_n += sentence_deltas[task];
+                }
+            }
+            for (auto &ali: aligners) {
+                for (const auto &row: ali->planner_log) {
+                    planner_log << '"' << row.ai->destination_theorem->pattern << "\","
+                        << row.pivot << "," << row.level << "," << row.var_id << ","
+                        << row.estimated_bindings << "," << row.actual_bindings << "\n";
+                }
+                ali->planner_log.clear();
+            }
+            cerr << "sv: " << sentence_valuations_found << endl;
+            cerr << "tv: " << theorem_valuations_found << endl;
+            if (!options.checkpoint_path.empty() && chrono::steady_clock::now() - last_checkpoint
+                    >= chrono::seconds(options.checkpoint_every_seconds)) {
+                save_checkpoint(options.checkpoint_path, to_align);
+                last_checkpoint = chrono::steady_clock::now();
+            }
+        }
+    }
+    if (!options.checkpoint_path.empty()) {
+        save_checkpoint(options.checkpoint_path, to_align);
+    }
+    if (profiling) {
+        save_join_profile(options.join_profile_path, to_align, profiles);
+    }
+}
+
+// column of the first var in binding order which occurs in the sentence,
+// it is the first one the sentence is split by; -1 if there is none
+int _Aligner::first_bound_column(int sentence_i) const {
+    for (int var_id: binding_order) {
+        for (const auto &occurence: ai->var_infos[var_id].key_occurences) {
+            if (occurence.sentence == sentence_i) {
+                return occurence.index;
+            }
+        }
+    }
+    return -1;
 }
 
 bool _Aligner::prepare_indices() {
+    if (!profiling) {
+        return fill_indices();
+    }
+    const auto started = chrono::steady_clock::now();
+    const bool res = fill_indices();
+    profile.prepare_seconds += seconds_since(started);
+    return res;
+}
+
+bool _Aligner::fill_indices() {
     indices.resize(sentences_n());
-    indices_memory_bank.grow();
-    assert(indices_memory_bank.size == 1);
+    presorted_columns.resize(sentences_n());
     for (int sentence_i = 0; sentence_i < sentences_n(); ++sentence_i) {
-        int valuation_index = 0;
         auto &sindices = indices[sentence_i];
         const auto &svequivalence = ai->var_equivalence[sentence_i];
+        const auto &constraints = ai->source_constraints[sentence_i];
+        const auto &source_range = source_ranges[sentence_i];
+        const auto &valuation_set = *sources_valuations[sentence_i];
 
-        sindices.set_items(&indices_memory_bank.back(), 0);
-        for (const auto &valuation: (*sources_valuations[sentence_i])) {
+        presorted_columns[sentence_i] = -1;
+        auto consider = [&](int valuation_index) {
+            const auto &valuation = valuation_set[valuation_index];
             assert(svequivalence.size == valuation.size);
-            bool bad = false;
-            for (const auto &var_constraint: ai->source_constraints[sentence_i]) {
+            for (const auto &var_constraint: constraints) {
                 if (valuation[var_constraint.index] != var_constraint.value) {
-                    bad = true;
-                    break;
+                    return;
                 }
             }
             for (size_t v_i = 0; v_i < valuation.size; ++v_i) {
                 if (valuation[v_i] != valuation[svequivalence[v_i]]) {
-                    bad = true;
-                    break;
+                    return;
+                }
+            }
+            sindices[sindices.size++] = valuation_index;
+        };
+
+        // rows come from a column index when it doesn't mean looking at
+        // many more rows than the range has: the constrained column narrows
+        // them down, the first bound column gives them presorted
+        const int range_size = source_range.second - source_range.first;
+        const int column = constraints.size > 0 ?
+            constraints[0].index : first_bound_column(sentence_i);
+        bool from_index = false;
+        if (column >= 0 && range_size > 0) {
+            const auto &index = ai->source_sentences[sentence_i]->column_index(column);
+            auto rows_begin = index.begin();
+            auto rows_end = index.end();
+            if (constraints.size > 0) {
+                const int value = constraints[0].value;
+                auto lower = lower_bound(index.begin(), index.end(), value,
+                    [&valuation_set, column](int vi, int v) -> bool {
+                        return valuation_set[vi][column] < v;
+                    });
+                auto upper = upper_bound(lower, index.end(), value,
+                    [&valuation_set, column](int v, int vi) -> bool {
+                        return v < valuation_set[vi][column];
+                    });
+                rows_begin = lower;
+                rows_end = upper;
+            }
+            if (rows_end - rows_begin <= 2 * range_size) {
+                from_index = true;
+                sindices.set_items(indices_arena.allocate(rows_end - rows_begin), 0);
+                for (auto it = rows_begin; it != rows_end; ++it) {
+                    if (*it >= source_range.first && *it < source_range.second) {
+                        consider(*it);
+                    }
+                }
+                if (constraints.size == 0) {
+                    presorted_columns[sentence_i] = column;
                 }
             }
-            if (!bad) {
-                indices_memory_bank.grow();
-                sindices[sindices.size++] = valuation_index;
+        }
+        if (!from_index) {
+            sindices.set_items(indices_arena.allocate(range_size), 0);
+            for (int vi = source_range.first; vi < source_range.second; ++vi) {
+                consider(vi);
             }
-            ++valuation_index;
         }
         if (sindices.size == 0) {
             return false;
@@ -110,6 +1039,8 @@ void _Aligner::split_by_var(int split_by_var_id) {
         auto &sindices = indices[occurence.sentence];
         assert(sindices.size > 0);
         assert(bound.first < bound.second);
+        // the first split of a sentence can come presorted
+        if (presorted_columns[occurence.sentence] == occurence.index) continue;
         auto &valuation_set = *sources_valuations[occurence.sentence];
         sort(&sindices[0] + bound.first, &sindices[0] + bound.second, 
             [&valuation_set, &occurence](const auto &a, const auto &b) -> bool {
@@ -121,7 +1052,7 @@ void _Aligner::split_by_var(int split_by_var_id) {
     for (int i = 0; i < sentences_n(); ++i) {
         processed_index.append(input_bounds[i].first);
     }
-    const auto &moccurence = occurences[0];
+    const auto &moccurence = occurences[main_occurences[split_by_var_id]];
     const auto &mbound = input_bounds[moccurence.sentence];
     auto &mindices = indices[moccurence.sentence];
     auto &mvaluation_set = *sources_valuations[moccurence.sentence];
@@ -147,7 +1078,11 @@ void _Aligner::split_by_var(int split_by_var_id) {
             ib.first = -1;
             ib.second = -1;
         }
-        for (const auto &occurence: occurences) {
+        // the main occurence goes first, so it moves past value
+        // even when another occurence has no match
+        for (size_t oc_i = 0; oc_i < occurences.size; ++oc_i) {
+            const auto &occurence = occurences[
+                (main_occurences[split_by_var_id] + oc_i) % occurences.size];
             int &pi = processed_index[occurence.sentence];
             const auto &bound = input_bounds[occurence.sentence];
             assert(bound.first != bound.second);
@@ -183,9 +1118,15 @@ void _Aligner::split_by_var(int split_by_var_id) {
 }
 
 void _Aligner::initialize_banned_var_values() {
-    banned_var_values.resize(0);
-    for (const auto &vi: ai->var_infos) {
-        banned_var_values.append(vi.different_than_const);
+    if (banned_var_values.size() < (size_t)vars_n()) {
+        banned_var_values.resize(vars_n());
+    }
+    for (int var_id = 0; var_id < vars_n(); ++var_id) {
+        auto &banned = banned_var_values[var_id];
+        banned.clear();
+        for (int value: ai->var_infos[var_id].different_than_const) {
+            banned.append(value);
+        }
     }
 }
 
@@ -207,12 +1148,11 @@ void _Aligner::unban(int var_id) {
 }
 
 void _Aligner::const_only_filler() {
-    DomainValuation new_valuation;
+    short *new_valuation = append_valuation();
     for (int vi: ai->domain_filling_pattern) {
         assert(vi < 0);
-        new_valuation.append(-vi - 1);
+        *(new_valuation++) = -vi - 1;
     }
-    new_valuations.push_back(new_valuation);
 }
 
 void _Aligner::compute() {
@@ -230,14 +1170,17 @@ void _Aligner::compute() {
 
     initialize_banned_var_values();
 
+    ++profile.stack_passes;
     bounds_stack.resize(1);
     for (int i = 0; i < sentences_n(); ++i) {
         bounds_stack[0].append(make_pair(0, (int)indices[i].size));
     }
     //print_bounds_stack();
-    split_by_var(ai->binding_order[0]);
+    split_by_var(binding_order[0]);
     LimitedArray<int, MAX_DOMAIN_VARS> level_size;
     level_size.append(bounds_stack.size);
+    actual_bindings[0] += bounds_stack.size;
+    profile.peak_bounds_stack = max(profile.peak_bounds_stack, bounds_stack.size);
     //cerr << "boom" << endl;
     //print_bounds_stack();
 
@@ -248,7 +1191,7 @@ void _Aligner::compute() {
             level_size.pop();
             const int level_id = level_size.size - 1;
             if (level_id >= 0) {
-                unban(ai->binding_order[level_id]);
+                unban(binding_order[level_id]);
             }
         }
         if (level_size.size == 0) break;
@@ -257,7 +1200,7 @@ void _Aligner::compute() {
         assert(level_size.back() > 0);
         --level_size.back();
         if (level_id == vars_n() - 1) {
-            DomainValuation new_valuation;
+            short *new_valuation = append_valuation();
             for (int vi: ai->domain_filling_pattern) {
                 if (vi > 0) {
                     --vi;
@@ -292,25 +1235,23 @@ void _Aligner::compute() {
                         print_bounds_stack();
                     }
                     assert(ib.first + 1 == ib.second);
-                    new_valuation.append(
+                    *(new_valuation++) =
                         sources_valuations[oc.sentence]->at(
                             indices[oc.sentence][ib.first]
-                        )[oc.index]
-                    );
+                        )[oc.index];
                 } else if (vi < 0) {
-                    new_valuation.append(-vi - 1);
+                    *(new_valuation++) = -vi - 1;
                 } else {
                     assert(0);
                 }
             }
-            new_valuations.push_back(new_valuation);
             bounds_stack.pop();
         } else {
             //cerr << "buum" << endl;
-            ban_by_var(ai->binding_order[level_id]);
+            ban_by_var(binding_order[level_id]);
             auto last = bounds_stack.back();
             size_t base = bounds_stack.size - 1;
-            split_by_var(ai->binding_order[level_id + 1]);
+            split_by_var(binding_order[level_id + 1]);
             if (level_id + 1 == vars_n() - 1) {
                 for (size_t bid = base; bid < bounds_stack.size; ++bid) {
                     for (const auto &bo: bounds_stack[bid]) {
@@ -331,7 +1272,7 @@ void _Aligner::compute() {
                                 cerr << lo.first << '/' << lo.second << " ";
                             }
                             cerr << endl;
-                            for (const auto &ko: ai->binding_order) {
+                            for (const auto &ko: binding_order) {
                                 cerr << ko << " ";
                             }
                             cerr << endl;
@@ -341,13 +1282,173 @@ void _Aligner::compute() {
                 }
             }
             level_size.append(bounds_stack.size - base);
+            profile.peak_bounds_stack = max(profile.peak_bounds_stack, bounds_stack.size);
+            actual_bindings[level_id + 1] += bounds_stack.size - base;
+        }
+    }
+}
+
+void _Aligner::trie_compute() {
+    if (!prepare_indices()) {
+        return;
+    }
+    if (vars_n() == 0) {
+        const_only_filler();
+        return;
+    }
+    initialize_banned_var_values();
+    if (profiling) {
+        const auto started = chrono::steady_clock::now();
+        prepare_tries();
+        profile.prepare_seconds += seconds_since(started);
+    } else {
+        prepare_tries();
+    }
+    IndexBound bounds;
+    for (int i = 0; i < sentences_n(); ++i) {
+        bounds.append(make_pair(0, (int)indices[i].size));
+    }
+    var_values.resize(vars_n());
+    trie_join(0, bounds);
+}
+
+// sorts indices of every sentence lexicographically by its var columns
+// in binding order, so each bound prefix selects a contiguous range
+// sorted by the column of the next var
+void _Aligner::prepare_tries() {
+    trie_columns.resize(sentences_n());
+    for (auto &columns: trie_columns) {
+        columns.resize(0);
+    }
+    for (int var_id: binding_order) {
+        assert(ai->var_infos[var_id].key_occurences.size > 0);
+        for (const auto &occurence: ai->var_infos[var_id].key_occurences) {
+            trie_columns[occurence.sentence].append(occurence.index);
+        }
+    }
+    for (int sentence_i = 0; sentence_i < sentences_n(); ++sentence_i) {
+        const auto &valuation_set = *sources_valuations[sentence_i];
+        const auto &columns = trie_columns[sentence_i];
+        auto &sindices = indices[sentence_i];
+        auto lexicographic = [&valuation_set, &columns](int a, int b) -> bool {
+            for (int column: columns) {
+                if (valuation_set[a][column] != valuation_set[b][column]) {
+                    return valuation_set[a][column] < valuation_set[b][column];
+                }
+            }
+            return false;
+        };
+        if (columns.size == 0 || presorted_columns[sentence_i] != columns[0]) {
+            sort(sindices.begin(), sindices.end(), lexicographic);
+            continue;
+        }
+        // sorted by the first column already, only runs of equal values
+        // need sorting by the rest
+        if (columns.size == 1) continue;
+        const int first_column = columns[0];
+        auto run_begin = sindices.begin();
+        while (run_begin != sindices.end()) {
+            const int value = valuation_set[*run_begin][first_column];
+            auto run_end = run_begin;
+            while (run_end != sindices.end() && valuation_set[*run_end][first_column] == value) {
+                ++run_end;
+            }
+            sort(run_begin, run_end, lexicographic);
+            run_begin = run_end;
+        }
+    }
+}
+
+int _Aligner::trie_seek(const VarOccurence &occurence, int from, int to, int value, bool after) const {
+    auto before_target = [&](int position) -> bool {
+        const int key = trie_key(occurence, position);
+        return after ? key <= value : key < value;
+    };
+    if (from >= to || !before_target(from)) {
+        return from;
+    }
+    // galloping: before_target(low) holds, find high where it doesn't
+    int low = from;
+    int step = 1;
+    while (low + step < to && before_target(low + step)) {
+        low += step;
+        step *= 2;
+    }
+    int high = min(low + step, to);
+    while (high - low > 1) {
+        const int middle = low + (high - low) / 2;
+        if (before_target(middle)) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return high;
+}
+
+void _Aligner::trie_join(int level, const IndexBound &bounds) {
+    if (level == vars_n()) {
+        short *new_valuation = append_valuation();
+        for (int vi: ai->domain_filling_pattern) {
+            assert(vi != 0);
+            *(new_valuation++) = vi > 0 ? var_values[vi - 1] : -vi - 1;
+        }
+        return;
+    }
+    const int var_id = binding_order[level];
+    const auto &occurences = ai->var_infos[var_id].key_occurences;
+    const auto &banned_values = banned_var_values[var_id];
+    IndexBound sub_bounds = bounds;
+    LimitedArray<int, MAX_SENTENCES_IN_THEOREM> positions;
+    for (const auto &occurence: occurences) {
+        positions.append(bounds[occurence.sentence].first);
+    }
+    int value = trie_key(occurences[0], positions[0]);
+    while ("Elvis Lives") {
+        // leapfrog: seek every occurence to the largest value seen,
+        // until all of them agree
+        bool aligned = true;
+        for (size_t i = 0; i < occurences.size; ++i) {
+            const auto &occurence = occurences[i];
+            const int end = bounds[occurence.sentence].second;
+            positions[i] = trie_seek(occurence, positions[i], end, value, false);
+            if (positions[i] == end) return;
+            const int key = trie_key(occurence, positions[i]);
+            if (key != value) {
+                value = key;
+                aligned = false;
+            }
+        }
+        if (!aligned) continue;
+        for (size_t i = 0; i < occurences.size; ++i) {
+            const auto &occurence = occurences[i];
+            const int end = bounds[occurence.sentence].second;
+            sub_bounds[occurence.sentence] = make_pair(
+                positions[i], trie_seek(occurence, positions[i], end, value, true));
+        }
+        if (!banned_values.contains(value)) {
+            ++actual_bindings[level];
+            var_values[var_id] = value;
+            for (int dvar_id: ai->var_infos[var_id].different_than) {
+                banned_var_values[dvar_id].append(value);
+            }
+            trie_join(level + 1, sub_bounds);
+            for (int dvar_id: ai->var_infos[var_id].different_than) {
+                banned_var_values[dvar_id].pop();
+            }
+        }
+        for (size_t i = 0; i < occurences.size; ++i) {
+            const auto &occurence = occurences[i];
+            positions[i] = sub_bounds[occurence.sentence].second;
+            if (positions[i] == bounds[occurence.sentence].second) return;
         }
+        value = trie_key(occurences[0], positions[0]);
     }
 }
 
 void _Aligner::print_bounds_stack() {
-    for (const auto &bo: bounds_stack) {
-        for (const auto &p: bo) {
+    for (size_t bid = 0; bid < bounds_stack.size; ++bid) {
+        for (const auto &p: bounds_stack[bid]) {
             cerr << p.first << "/" << p.second << " ";
         }
         cerr << "\n";
@@ -2,6 +2,11 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
 
 using namespace std;
 #include "common.hpp"
@@ -20,7 +25,10 @@ struct AlignmentVarInfo {
 
 
 struct Domain;
-struct AlignmentInfo {
+// Alignment metadata of a theorem while HighNode::alignment_info() collects
+// it, every array has its maximal size. Only one exists at a time,
+// the kept ones are AlignmentInfos.
+struct AlignmentInfoBuilder {
     Domain *destination_theorem, *destination_sentence;
     int sources_new_valuations_n;
     LimitedArray<Domain*, MAX_SENTENCES_IN_THEOREM> source_sentences;
@@ -31,13 +39,101 @@ struct AlignmentInfo {
 
     // filling_pattern - negative = (-(renamed_token + 1)), positive = exp_var_id + 1
     LimitedArray<int, MAX_DOMAIN_VARS> domain_filling_pattern;
-    // one var occurence per sentence
-    LimitedArray<VarOccurence, MAX_SENTENCES_IN_THEOREM> key_occurences; 
     LimitedArray<LimitedArray<int, MAX_DOMAIN_VARS>, MAX_SENTENCES_IN_THEOREM> var_equivalence;
+    LimitedArray<int, MAX_SENTENCES_IN_THEOREM> source_watermarks;
 };
 
+struct CompactVarInfo {
+    SizedArray<VarOccurence> occurences;
+    // one occurence per sentence
+    SizedArray<VarOccurence> key_occurences;
+    SizedArray<int> different_than;
+    SizedArray<int> different_than_const;
+};
+
+// The same metadata with arrays of their real sizes, all of them packed
+// in one buffer. Arrays are views into the buffer, a copy packs its own
+// buffer, a move takes it over.
+struct AlignmentInfo {
+    Domain *destination_theorem, *destination_sentence;
+    int sources_new_valuations_n;
+    SizedArray<Domain*> source_sentences;
+    SizedArray<SizedArray<VarConstraint>> source_constraints;
+    SizedArray<CompactVarInfo> var_infos;
+    SizedArray<int> binding_order;
+    // filling_pattern - negative = (-(renamed_token + 1)), positive = exp_var_id + 1
+    SizedArray<int> domain_filling_pattern;
+    SizedArray<SizedArray<int>> var_equivalence;
+    // number of valuations of each source already joined by this theorem,
+    // valuations are only appended to domains, so the rest is the delta
+    SizedArray<int> source_watermarks;
+
+    unique_ptr<long long[]> buffer;
+    size_t buffer_bytes;
 
-void fix_point_align(vector<AlignmentInfo> &to_align);
+    AlignmentInfo();
+    explicit AlignmentInfo(const AlignmentInfoBuilder &builder);
+    AlignmentInfo(const AlignmentInfo &other);
+    AlignmentInfo(AlignmentInfo &&other) noexcept;
+    AlignmentInfo &operator=(const AlignmentInfo &other);
+    AlignmentInfo &operator=(AlignmentInfo &&other) noexcept;
+
+    size_t memory_bytes() const {
+        return sizeof(AlignmentInfo) + buffer_bytes;
+    }
+
+private:
+    template <typename Source>
+    void pack(const Source &source);
+    template <typename Source>
+    void layout(const Source &source, char *base, size_t &offset);
+    void take_views(const AlignmentInfo &other);
+};
+
+
+namespace JOIN_ENGINE {
+    enum {
+        SORT_SPLIT, // sorts index ranges by each bound variable
+        TRIE // leapfrog triejoin over sources sorted in binding order
+    };
+};
+
+struct AlignOptions {
+    int threads_n; // joins of one round run on threads_n threads
+    int join_engine;
+    bool plan; // cost-based binding order instead of the static one
+    // sort-split join always by compute, not by kernels specialized
+    // for small theorems
+    bool generic_join;
+    string planner_log_path; // csv of estimated and actual bindings per level
+    string join_profile_path; // csv of counters and times per theorem
+    // domains and alignment progress are saved there every
+    // checkpoint_every_seconds (between rounds) and when the fix point is reached
+    string checkpoint_path;
+    int checkpoint_every_seconds;
+    bool resume; // start from checkpoint_path if it exists
+    // bytes domains and join buffers may take, 0 - no limit. Checked before
+    // every round and while joins add rows, fix_point_align throws
+    // MemoryBudgetExceeded when it is passed.
+    size_t memory_budget;
+    AlignOptions() {
+        threads_n = 1;
+        join_engine = JOIN_ENGINE::SORT_SPLIT;
+        plan = false;
+        generic_join = false;
+        checkpoint_every_seconds = 600;
+        resume = false;
+        memory_budget = 0;
+    }
+};
+
+// Grounding was stopped between rounds, domains keep what the finished
+// rounds found. The largest domains are listed on stderr.
+struct MemoryBudgetExceeded: runtime_error {
+    explicit MemoryBudgetExceeded(const string &what): runtime_error(what) {}
+};
+
+void fix_point_align(vector<AlignmentInfo> &to_align, const AlignOptions &options = AlignOptions());
 
 namespace DTYPE {
     enum {
@@ -51,8 +147,19 @@ struct Domain {
     int type; // 
     string pattern; // next and init are replaced by true, legal by does
     string original_pattern; // pattern 
-    vector<DomainValuation> valuations;
+    ValuationRows valuations; // unique, new ones are appended
+    // open addressing hash set of valuation indices, -1 marks an empty slot,
+    // its size is a power of two
+    vector<int> membership;
     int valuation_size;
+    mutex lock; // taken by add_valuations callers during parallel merges
+    // permutations of valuations sorted by one column (ties by position),
+    // built on first use and extended when the domain grows
+    vector<vector<int>> column_indexes;
+    vector<int> column_indexed_n;
+    vector<int> column_distinct_n;
+    // original_pattern split at every '#', valuation_size + 1 pieces
+    vector<string> pattern_pieces;
     Domain(){}
     Domain(string _pattern, string _original_pattern, int _type) {
         type = _type;
@@ -61,11 +168,40 @@ struct Domain {
         id = str_hasher(pattern);
         valuation_size = count(pattern.begin(), pattern.end(), '#');
         assert(valuation_size <= MAX_DOMAIN_VARS);
+        valuations.reset(valuation_size);
+        pattern_pieces.push_back("");
+        for (char c: original_pattern) {
+            if (c == '#') {
+                pattern_pieces.push_back("");
+            } else {
+                pattern_pieces.back() += c;
+            }
+        }
     }
+
+    // appends valuations which are not in domain yet, returns their number
+    int add_valuations(const ValuationRows &to_add);
+    // drops all valuations and indexes, then adds these in their order
+    void replace_valuations(const ValuationRows &new_valuations);
+    // valuation indices in the order of valuations
+    vector<int> sorted_order() const;
+    // valuations, membership and column indexes
+    size_t memory_bytes() const;
+
+    // thread safe, as long as nothing is added at the same time
+    const vector<int> &column_index(int column);
+    int distinct_values(int column);
+
+private:
+    size_t valuation_hash(int vi) const;
+    bool insert_membership(int vi);
+    void rehash_membership(size_t slots_n);
+public:
     
     string to_string() {
         string res = pattern + "\n";
-        for (auto &dv: valuations) {
+        for (int vi: sorted_order()) {
+            const auto &dv = valuations[vi];
             for (int i = 0; i < valuation_size; ++i) {
                 res += " " + globals().reverse_numeric_rename[dv[i]];
             }
@@ -76,58 +212,192 @@ struct Domain {
     
     string to_full_string() const {
         string res;
-        for (const auto &valuation: valuations) {
-            res += to_string_with_valuation(valuation) + '\n';
+        for (int vi: sorted_order()) {
+            append_with_valuation(res, valuations[vi]);
+            res += '\n';
         }
         return res;
     }
 
-    string to_string_with_valuation(const DomainValuation &valuation) const {
+    string to_string_with_valuation(const ValuationView &valuation) const {
         string res;
-        int i = 0;
-        for (char c: original_pattern) {
-            string to_append;
-            if (c == '#') {
-                to_append = globals().reverse_numeric_rename[valuation[i]];
-                ++i;
-            } else {
-                to_append = c;
-            }
-            res += to_append;
-        }
+        append_with_valuation(res, valuation);
         return res;
     }
+
+    void append_with_valuation(string &res, const ValuationView &valuation) const {
+        assert(pattern_pieces.size() == valuation.size + 1);
+        res += pattern_pieces[0];
+        for (size_t i = 0; i < valuation.size; ++i) {
+            res += globals().reverse_numeric_rename[valuation[i]];
+            res += pattern_pieces[i + 1];
+        }
+    }
+};
+
+// Values a var can't take, as a bitset over symbol ids for O(1) checks
+// and a stack in the order they were banned. Values are unbanned in
+// reverse order and one value can be banned more than once, so a bit is
+// cleared only when its value isn't on the stack anymore.
+struct BannedValues {
+    vector<uint64_t> bits; // grows up to the largest banned value
+    LimitedArray<int, MAX_DOMAIN_VARS> stack;
+
+    bool contains(int value) const {
+        const size_t word = value >> 6;
+        return word < bits.size() && (bits[word] >> (value & 63) & 1);
+    }
+
+    void append(int value) {
+        assert(value >= 0 && value <= SHRT_MAX);
+        const size_t word = value >> 6;
+        if (word >= bits.size()) {
+            bits.resize(word + 1, 0);
+        }
+        bits[word] |= uint64_t(1) << (value & 63);
+        stack.append(value);
+    }
+
+    void pop() {
+        const int value = stack.back();
+        stack.pop();
+        if (!stack.contains(value)) {
+            bits[value >> 6] &= ~(uint64_t(1) << (value & 63));
+        }
+    }
+
+    void clear() {
+        for (int value: stack) {
+            bits[value >> 6] &= ~(uint64_t(1) << (value & 63));
+        }
+        stack.resize(0);
+    }
+};
+
+struct PlannerLogRow {
+    const AlignmentInfo *ai;
+    int pivot; // source joined by its new valuations only
+    int level;
+    int var_id;
+    double estimated_bindings;
+    long long actual_bindings;
+};
+
+// Counters and times of the joins of one theorem, summed over rounds.
+// peak_bounds_stack is only tracked by compute, kernels and the trie join
+// keep their bounds on the call stack, so it is left out of the profile
+// of a theorem without stack_passes.
+struct JoinProfile {
+    long long runs; // find_valuations calls
+    long long passes; // non-empty semi-naive passes
+    long long stack_passes; // passes run by compute
+    long long rows_consumed; // source rows in the ranges of the passes
+    long long rows_produced; // before deduplication
+    long long theorem_duplicates, sentence_duplicates;
+    size_t peak_bounds_stack;
+    double prepare_seconds; // prepare_indices, prepare_tries
+    double join_seconds; // the rest of the passes, with output rows
+    double add_seconds; // adding to the destination domains
+    JoinProfile() {
+        runs = 0;
+        passes = 0;
+        stack_passes = 0;
+        rows_consumed = 0;
+        rows_produced = 0;
+        theorem_duplicates = 0;
+        sentence_duplicates = 0;
+        peak_bounds_stack = 0;
+        prepare_seconds = 0;
+        join_seconds = 0;
+        add_seconds = 0;
+    }
+
+    void add(const JoinProfile &other);
 };
 
 struct _Aligner {
     typedef LimitedArray<pair<int, int>, MAX_SENTENCES_IN_THEOREM> IndexBound;
-    typedef LimitedArray<const vector<DomainValuation>*, MAX_SENTENCES_IN_THEOREM> SourcesValuations;
-    LimitedArray<IndexBound, MAX_TERMS_N * 3> bounds_stack;
-    LimitedArray<int, MAX_TERMS_N * 3> indices_memory_bank;
+    typedef LimitedArray<const ValuationRows*, MAX_SENTENCES_IN_THEOREM> SourcesValuations;
+    ChunkedStack<IndexBound> bounds_stack;
+    // memory of indices, reset for every pass
+    Arena<int> indices_arena;
 
     const AlignmentInfo *ai;
     SourcesValuations sources_valuations;
+    // sizes of sources when join started and rows of each source used
+    // in the current semi-naive pass
+    LimitedArray<int, MAX_SENTENCES_IN_THEOREM> source_sizes;
+    LimitedArray<pair<int, int>, MAX_SENTENCES_IN_THEOREM> source_ranges;
 
     LimitedArray<SizedArray<int>, MAX_SENTENCES_IN_THEOREM> indices;
-    LimitedArray<LimitedArray<int, MAX_DOMAIN_VARS>, MAX_DOMAIN_VARS> banned_var_values;
-    vector<DomainValuation> new_valuations;
+    // column by which indices of a sentence are already sorted, or -1
+    LimitedArray<int, MAX_SENTENCES_IN_THEOREM> presorted_columns;
+    // by var, kept between passes so bitsets aren't allocated again
+    vector<BannedValues> banned_var_values;
+    ValuationRows new_valuations;
 
-    void find_valuations(const AlignmentInfo *_ai) {
-        initialize(_ai);
-        compute();
+    int join_engine;
+    bool plan;
+    bool generic_join;
+    bool log_plans;
+    bool profiling;
+    JoinProfile profile; // of the last find_valuations if profiling
+    // bytes new_valuations may take, 0 - no limit. Past it the join is
+    // abandoned by throwing RowsLimitReached.
+    size_t bytes_limit;
+    struct RowsLimitReached {};
+    // binding order of the current pass and for every var which of its
+    // key occurences split_by_var scans
+    LimitedArray<int, MAX_DOMAIN_VARS> binding_order;
+    LimitedArray<int, MAX_DOMAIN_VARS> main_occurences;
+    LimitedArray<double, MAX_DOMAIN_VARS> estimated_bindings;
+    LimitedArray<long long, MAX_DOMAIN_VARS> actual_bindings;
+    vector<PlannerLogRow> planner_log;
+    // trie join: var columns of every sentence in binding order
+    // and values of bound vars
+    LimitedArray<LimitedArray<int, MAX_DOMAIN_VARS>, MAX_SENTENCES_IN_THEOREM> trie_columns;
+    LimitedArray<int, MAX_DOMAIN_VARS> var_values;
+
+    _Aligner() {
+        join_engine = JOIN_ENGINE::SORT_SPLIT;
+        plan = false;
+        generic_join = false;
+        log_plans = false;
+        profiling = false;
+        bytes_limit = 0;
     }
 
+    // finds valuations which use at least one source valuation
+    // past ai->source_watermarks
+    void find_valuations(const AlignmentInfo *_ai);
+
     void initialize(const AlignmentInfo *_ai) {
         ai = _ai;
-        new_valuations.resize(0);
-        bounds_stack.resize(0);
-        indices_memory_bank.resize(0);
+        new_valuations.reset(ai->domain_filling_pattern.size);
         sources_valuations.resize(0);
+        source_sizes.resize(0);
         for (const auto &source: ai->source_sentences) {
             sources_valuations.append(&source->valuations);
+            source_sizes.append(source->valuations.size());
         }
     }
 
+    // the row to fill with the next valuation found
+    short *append_valuation() {
+        if (bytes_limit > 0 && new_valuations.items.size() * sizeof(short) >= bytes_limit) {
+            throw RowsLimitReached();
+        }
+        return new_valuations.append_row();
+    }
+
+    // buffers kept between joins
+    size_t memory_bytes() const;
+
+    void start_pass() {
+        bounds_stack.resize(0);
+        indices_arena.reset();
+    }
+
     int sentences_n() const {
         return ai->source_sentences.size;
     }
@@ -136,7 +406,11 @@ struct _Aligner {
         return ai->var_infos.size;
     }
 
+    void plan_binding_order();
+    void log_pass(int pivot);
+    int first_bound_column(int sentence_i) const;
     bool prepare_indices();
+    bool fill_indices();
     void split_by_var(int split_by_var_id);
     void initialize_banned_var_values();
     void ban_by_var(int var_id); 
@@ -144,5 +418,15 @@ struct _Aligner {
     void const_only_filler();
     void compute();
 
+    void trie_compute();
+    void prepare_tries();
+    void trie_join(int level, const IndexBound &bounds);
+    int trie_key(const VarOccurence &occurence, int position) const {
+        return (*sources_valuations[occurence.sentence])[
+            indices[occurence.sentence][position]][occurence.index];
+    }
+    // first position in [from, to) with key >= value (key > value if after)
+    int trie_seek(const VarOccurence &occurence, int from, int to, int value, bool after) const;
+
     void print_bounds_stack();
 };
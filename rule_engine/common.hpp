@@ -6,8 +6,10 @@ using namespace std;
 #include "MyArrays.hpp"
 const int MAX_DOMAIN_VARS = 80;
 const int MAX_SENTENCES_IN_THEOREM = 15;
-const int MAX_TERMS_N = 200000;
 typedef LimitedArray<short, MAX_DOMAIN_VARS> DomainValuation;
+// valuations of a domain, one row of valuation_size symbols each
+typedef FlatRows<short> ValuationRows;
+typedef RowView<short> ValuationView;
 
 
 #define NAMED_PAIR(name, first_v_type, first_v_name, second_v_type, second_v_name) \
@@ -9,23 +9,16 @@
 #include <algorithm>
 #include <cstring>
 #include <climits>
+#include <cstdlib>
 
 
-#ifndef NO_BACKWARD
-#define BACKWARD_HAS_DW 1
-#include "backward.hpp"
-
-namespace backward {
-    backward::SignalHandling sh;
-};
-
-#endif
-
 #include "MyArrays.hpp"
 #include "GDLTokenizer.hpp"
 #include "common.hpp"
 #include "aligner.hpp"
 #include "HighNode.hpp"
+#include "thread_pool.hpp"
+#include "flattener.hpp"
 
 using namespace std;
 
@@ -43,12 +36,67 @@ void collect_domain_types(vector<HighNode> & vhn) {
 }
 
 
+static string head_symbol(const string &pattern) {
+    return pattern.substr(0, pattern.find(' '));
+}
+
+// Keeps only rules which can influence true (next, init), does (legal),
+// goal or terminal: rules are followed backwards from them through
+// positive and negated sentences of their bodies. Whole families are kept
+// or dropped by their head domain, this is no magic-set rewrite: every
+// instantiation of a kept rule is still grounded, needed or not.
+vector<HighNode> relevant_rules(const vector<HighNode> &rules) {
+    unordered_map<size_t, vector<int>> rules_by_head;
+    for (size_t rule_i = 0; rule_i < rules.size(); ++rule_i) {
+        rules_by_head[rules[rule_i].sub[0].domain_hash].push_back(rule_i);
+    }
+    const unordered_set<string> output_symbols = {"true", "does", "goal", "terminal"};
+    unordered_set<size_t> relevant;
+    vector<size_t> to_visit;
+    for (const auto &rule: rules) {
+        const auto &head = rule.sub[0];
+        if (output_symbols.count(head_symbol(head.domain_pattern))
+                && relevant.insert(head.domain_hash).second) {
+            to_visit.push_back(head.domain_hash);
+        }
+    }
+    vector<bool> kept(rules.size(), false);
+    while (!to_visit.empty()) {
+        const size_t domain_hash = to_visit.back();
+        to_visit.pop_back();
+        for (int rule_i: rules_by_head[domain_hash]) {
+            kept[rule_i] = true;
+            const auto &rule = rules[rule_i];
+            for (size_t i = 1; i < rule.sub.size(); ++i) {
+                const HighNode &literal = rule.sub[i];
+                if (globals().reverse_numeric_rename[literal.value] == "distinct") continue;
+                const size_t body_hash = body_domain_hash(literal);
+                if (relevant.insert(body_hash).second) {
+                    to_visit.push_back(body_hash);
+                }
+            }
+        }
+    }
+    vector<HighNode> res;
+    for (size_t rule_i = 0; rule_i < rules.size(); ++rule_i) {
+        if (kept[rule_i]) {
+            res.push_back(rules[rule_i]);
+        }
+    }
+    cerr << "relevant rules: " << res.size() << " of " << rules.size() << endl;
+    return res;
+}
+
+
 void collect_initial_valuations(const vector<HighNode> &rules){
     for (const HighNode &hn: rules) {
         if (hn.type == TYPE::SENTENCE) {
-            DomainValuation new_valuation;
-            hn.gather_base_valuations_from_consts(new_valuation);
-            domain_map[hn.domain_hash]->valuations.push_back(new_valuation);
+            DomainValuation valuation;
+            hn.gather_base_valuations_from_consts(valuation);
+            Domain &domain = *domain_map[hn.domain_hash];
+            ValuationRows new_valuation(domain.valuation_size);
+            new_valuation.push_back(valuation);
+            domain.add_valuations(new_valuation);
         }
     }
 }
@@ -56,91 +104,166 @@ void collect_initial_valuations(const vector<HighNode> &rules){
 
 void collect_alignment_infos(const vector<HighNode> &rules, vector<AlignmentInfo> &res) {
     res.resize(0);
+    size_t memory_bytes = 0;
     for (const auto &hn: rules) {
         if (hn.type == TYPE::THEOREM) {
-            AlignmentInfo ai = hn.alignment_info();
-            res.push_back(ai);
-            // TODO remove asserts
-            assert(ai.source_sentences == res.back().source_sentences);
-            for (const auto &sv: ai.source_sentences) {
-                assert(sv);
-            }
+            res.push_back(hn.alignment_info());
             for (const auto &sv: res.back().source_sentences) {
                 assert(sv);
             }
+            memory_bytes += res.back().memory_bytes();
             //cerr << res.back().sources_new_valuations_n << endl;
             //cerr << hn.domain_pattern << endl;
             //cerr << domain_map[hn.sub[0].domain_hash].to_string();
         }
     }
+    cerr << "alignment infos: " << res.size() << ", " << memory_bytes << " bytes" << endl;
 }
 
 
-void fill_domains(const vector<HighNode> &rules) {
+void fill_domains(const vector<HighNode> &rules, const AlignOptions &options) {
     collect_initial_valuations(rules);
     vector<AlignmentInfo> alignment_infos;
     collect_alignment_infos(rules, alignment_infos);
     cerr << "starting fix point align" << endl;
-    fix_point_align(alignment_infos);
+    fix_point_align(alignment_infos, options);
 }
 
 
-void print_solved_theorems(const vector<HighNode> &rules, const string &outf_name) {
-    unordered_set<string> printed_strings;
+// Theorems are printed as the valuations of their domains, each domain
+// once (valuations within a domain are unique already), other rules as
+// their text, deduplicated by its 64-bit hash. Domains are sorted and
+// formatted in chunks of rows on the pool, a batch of chunks at a time,
+// and the chunks are written in order.
+void print_solved_theorems(const vector<HighNode> &rules, const string &outf_name, int threads_n) {
+    const size_t CHUNK_ROWS = 4096;
+    ThreadPool pool(threads_n);
     ofstream output_file(outf_name);
+    if (!output_file) {
+        throw runtime_error("can't open file: " + outf_name);
+    }
     cerr << "printing..." << endl;
+    // in output order, texts have no domain
+    vector<pair<const Domain*, string>> to_print;
+    unordered_set<size_t> printed_domains;
+    unordered_set<size_t> printed_texts;
     for (auto &rule: rules) {
-        string to_print;
-        const auto &dom = *domain_map[rule.domain_hash]; 
         if (rule.type != TYPE::THEOREM) {
             assert(rule.type == TYPE::SENTENCE);
-            to_print = "( <= " + rule.to_string() + " )\n";
+            const string text = "( <= " + rule.to_string() + " )\n";
+            if (printed_texts.insert(hash<string>()(text)).second) {
+                to_print.push_back(make_pair(nullptr, text));
+            }
         } else {
-            to_print = dom.to_full_string();
+            const Domain *dom = domain_map[rule.domain_hash];
+            if (printed_domains.insert(dom->id).second) {
+                to_print.push_back(make_pair(dom, string()));
+            }
         }
-        if (printed_strings.count(to_print) == 0) {
-            printed_strings.insert(to_print);
-            output_file << to_print;
+    }
+    vector<vector<int>> orders(to_print.size());
+    pool.run(to_print.size(), [&](int item, int) {
+        if (to_print[item].first) {
+            orders[item] = to_print[item].first->sorted_order();
+        }
+    });
+
+    struct Chunk {
+        int item;
+        size_t begin, end; // positions in the item's order
+    };
+    vector<Chunk> chunks;
+    for (size_t item = 0; item < to_print.size(); ++item) {
+        size_t begin = 0;
+        do {
+            const size_t end = min(orders[item].size(), begin + CHUNK_ROWS);
+            chunks.push_back({(int)item, begin, end});
+            begin = end;
+        } while (begin < orders[item].size());
+    }
+    const size_t batch_size = pool.size() * 4;
+    vector<string> buffers(batch_size);
+    for (size_t first = 0; first < chunks.size(); first += batch_size) {
+        const size_t chunks_n = min(batch_size, chunks.size() - first);
+        pool.run(chunks_n, [&](int task, int) {
+            const Chunk &chunk = chunks[first + task];
+            const Domain *dom = to_print[chunk.item].first;
+            string &buffer = buffers[task];
+            buffer.clear();
+            if (!dom) {
+                buffer = to_print[chunk.item].second;
+                return;
+            }
+            const auto &order = orders[chunk.item];
+            for (size_t i = chunk.begin; i < chunk.end; ++i) {
+                dom->append_with_valuation(buffer, dom->valuations[order[i]]);
+                buffer += '\n';
+            }
+        });
+        for (size_t task = 0; task < chunks_n; ++task) {
+            output_file.write(buffers[task].data(), buffers[task].size());
         }
     }
 }
 
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        cerr << "Usage:\n" << argv[0] << " INPUT OUTPUT" << endl;
-        return 1;
+bool parse_flatten_option(int argc, char **argv, int &i, FlattenOptions &options) {
+    AlignOptions &align = options.align;
+    const string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+        align.threads_n = max(1, atoi(argv[++i]));
+    } else if (arg == "--join" && i + 1 < argc && string(argv[i + 1]) == "sort") {
+        align.join_engine = JOIN_ENGINE::SORT_SPLIT;
+        ++i;
+    } else if (arg == "--join" && i + 1 < argc && string(argv[i + 1]) == "trie") {
+        align.join_engine = JOIN_ENGINE::TRIE;
+        ++i;
+    } else if (arg == "--relevant-only") {
+        options.relevant_only = true;
+    } else if (arg == "--plan") {
+        align.plan = true;
+    } else if (arg == "--generic-join") {
+        align.generic_join = true;
+    } else if (arg == "--planner-log" && i + 1 < argc) {
+        align.planner_log_path = argv[++i];
+    } else if (arg == "--join-profile" && i + 1 < argc) {
+        align.join_profile_path = argv[++i];
+    } else if (arg == "--checkpoint" && i + 1 < argc) {
+        align.checkpoint_path = argv[++i];
+    } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+        align.checkpoint_every_seconds = max(0, atoi(argv[++i]));
+    } else if (arg == "--resume") {
+        align.resume = true;
+    } else if (arg == "--ground-memory-budget" && i + 1 < argc) {
+        align.memory_budget = (size_t)max(0LL, atoll(argv[++i])) << 20;
+    } else {
+        return false;
     }
+    return true;
+}
+
+
+bool ground_rules(const string &input_path, const FlattenOptions &options, vector<HighNode> &rules) {
     vector<GDLToken> rule_tokens;
-    GDLTokenizer::tokenize(argv[1], rule_tokens);
+    GDLTokenizer::tokenize(input_path, rule_tokens);
 //    for (const auto &token: rule_tokens) {
 //        cerr << token.to_nice_string() + "\n";
 //    }
 //    cerr << "XXXX" << endl;
-    vector<HighNode> rules = HighNode::generate_from_tokens(rule_tokens); 
+    rules = HighNode::generate_from_tokens(rule_tokens); 
     for (const auto &rule: rules) {
         assert(rule.type == TYPE::THEOREM);
     }
     collect_domain_types(rules);
-//    cerr << rules.size() << endl;
-    fill_domains(rules);
-    print_solved_theorems(rules, argv[2]);
-    int legal_counter = 0;
-    int true_counter = 0;
-    for (const auto &dit: domain_map) {
-        const auto &dom = *dit.second;
-        if (dom.type == DTYPE::SENTENCE) {
-            if (dom.pattern.substr(0, 5) == "does ") {
-                legal_counter += dom.valuations.size();
-            }
-            if (dom.pattern.substr(0, 5) == "true ") {
-                true_counter += dom.valuations.size();
-            }
-        }
+    if (options.relevant_only) {
+        rules = relevant_rules(rules);
     }
-    cerr << "LEGALS: " << legal_counter << " " << "NEXTS: " << true_counter << endl;
-    for (const auto &fo: domain_map) {
-        delete fo.second;
+//    cerr << rules.size() << endl;
+    try {
+        fill_domains(rules, options.align);
+    } catch (const MemoryBudgetExceeded &e) {
+        cerr << e.what() << endl;
+        return false;
     }
-    return 0;
+    return true;
 }
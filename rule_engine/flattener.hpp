@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <string>
+
+using namespace std;
+#include "aligner.hpp"
+#include "HighNode.hpp"
+
+struct FlattenOptions {
+    AlignOptions align;
+    // ground only rule families (all rules with the head's domain) which
+    // true, does, goal or terminal depend on; instantiations of a kept
+    // family aren't restricted by demand
+    bool relevant_only;
+    FlattenOptions() {
+        relevant_only = false;
+    }
+};
+
+const char *const FLATTEN_OPTIONS_USAGE =
+    "[--threads N] [--join sort|trie] [--generic-join] [--plan] [--planner-log PATH] [--join-profile PATH] [--relevant-only]"
+    " [--checkpoint PATH [--checkpoint-every SECONDS] [--resume]]"
+    " [--ground-memory-budget MB]";
+
+// exit code of flatten and ground_and_compile when grounding passed
+// --ground-memory-budget, OUTPUT.partial has the theorems found until then
+const int EXIT_OVER_MEMORY_BUDGET = 3;
+
+// parses argv[i] and its value, false if it isn't a flattener option
+bool parse_flatten_option(int argc, char **argv, int &i, FlattenOptions &options);
+
+void collect_domain_types(vector<HighNode> &rules);
+vector<HighNode> relevant_rules(const vector<HighNode> &rules);
+void fill_domains(const vector<HighNode> &rules, const AlignOptions &options);
+void print_solved_theorems(const vector<HighNode> &rules, const string &outf_name, int threads_n);
+// reads the game in input_path and grounds its rules, valuations of every
+// theorem end up in its domain in globals().domain_map. False if grounding
+// was stopped by options.align.memory_budget, domains are partial then.
+bool ground_rules(const string &input_path, const FlattenOptions &options, vector<HighNode> &rules);
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+
+#ifndef NO_BACKWARD
+#define BACKWARD_HAS_DW 1
+#include "backward.hpp"
+
+namespace backward {
+    backward::SignalHandling sh;
+};
+
+#endif
+
+using namespace std;
+#include "common.hpp"
+#include "flattener.hpp"
+
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "Usage:\n" << argv[0] << " INPUT OUTPUT " << FLATTEN_OPTIONS_USAGE << endl;
+        return 1;
+    }
+    FlattenOptions options;
+    for (int i = 3; i < argc; ++i) {
+        if (!parse_flatten_option(argc, argv, i, options)) {
+            cerr << "unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (options.align.resume && options.align.checkpoint_path.empty()) {
+        cerr << "--resume needs --checkpoint PATH" << endl;
+        return 1;
+    }
+    vector<HighNode> rules;
+    if (!ground_rules(argv[1], options, rules)) {
+        print_solved_theorems(rules, string(argv[2]) + ".partial", options.align.threads_n);
+        return EXIT_OVER_MEMORY_BUDGET;
+    }
+    print_solved_theorems(rules, argv[2], options.align.threads_n);
+    auto &domain_map = globals().domain_map;
+    int legal_counter = 0;
+    int true_counter = 0;
+    for (const auto &dit: domain_map) {
+        const auto &dom = *dit.second;
+        if (dom.type == DTYPE::SENTENCE) {
+            if (dom.pattern.substr(0, 5) == "does ") {
+                legal_counter += dom.valuations.size();
+            }
+            if (dom.pattern.substr(0, 5) == "true ") {
+                true_counter += dom.valuations.size();
+            }
+        }
+    }
+    cerr << "LEGALS: " << legal_counter << " " << "NEXTS: " << true_counter << endl;
+    for (const auto &fo: domain_map) {
+        delete fo.second;
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <cassert>
+
+#ifndef NO_BACKWARD
+#define BACKWARD_HAS_DW 1
+#include "backward.hpp"
+
+namespace backward {
+    backward::SignalHandling sh;
+};
+
+#endif
+
+using namespace std;
+#include "common.hpp"
+#include "flattener.hpp"
+#include "recompressor.hpp"
+
+// flatten and recompress in one process: ground theorems go from the
+// domains straight to the recompressor, without printing, reprinting
+// and parsing them again
+
+
+// Theorem with every variable and constant replaced by a value of one
+// valuation of its domain. Leaves are in the order of '#' in the domain
+// pattern, so a valuation is assigned column by column.
+struct GroundTheorem {
+    HighNode node;
+    vector<HighNode*> leaves; // into node, GroundTheorem can't be copied
+
+    explicit GroundTheorem(const HighNode &theorem) : node(theorem) {
+        collect_leaves(node);
+    }
+
+    GroundTheorem(const GroundTheorem &) = delete;
+    GroundTheorem &operator=(const GroundTheorem &) = delete;
+
+    void assign(const ValuationView &valuation) {
+        assert(valuation.size == leaves.size());
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            leaves[i]->value = valuation[i];
+        }
+    }
+
+private:
+    void collect_leaves(HighNode &hn) {
+        for (auto &sub: hn.sub) {
+            if (sub.type == TYPE::VAR || sub.type == TYPE::CONST) {
+                sub.type = TYPE::CONST;
+                leaves.push_back(&sub);
+            } else {
+                collect_leaves(sub);
+            }
+        }
+    }
+};
+
+
+// The reprinter drops rules with a symbol containing "base" or "input"
+// and rules with a distinct of two equal terms.
+struct ReprinterFilter {
+    vector<bool> dropped_symbols;
+    int distinct_id;
+
+    ReprinterFilter() {
+        distinct_id = str_token_to_int("distinct");
+        const auto &names = globals().reverse_numeric_rename;
+        dropped_symbols.resize(names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            dropped_symbols[i] = names[i].find("base") != string::npos
+                || names[i].find("input") != string::npos;
+        }
+    }
+
+    bool keeps(const HighNode &node) const {
+        if (node.type != TYPE::THEOREM && dropped_symbols[node.value]) {
+            return false;
+        }
+        if (node.value == distinct_id && node.sub.size() == 2
+                && same_term(node.sub[0], node.sub[1])) {
+            return false;
+        }
+        for (const auto &sub: node.sub) {
+            if (!keeps(sub)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static bool same_term(const HighNode &a, const HighNode &b) {
+        if (a.value != b.value || a.sub.size() != b.sub.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.sub.size(); ++i) {
+            if (!same_term(a.sub[i], b.sub[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+// Ground theorems in the order the flattener prints them, each domain once,
+// filtered like the reprinter does it, but not sorted.
+RuleSource ground_theorem_source(const vector<HighNode> &rules) {
+    return [&rules](const RuleVisitor &visit) {
+        ReprinterFilter filter;
+        unordered_set<size_t> visited_domains;
+        for (const auto &rule: rules) {
+            const Domain &domain = *globals().domain_map[rule.domain_hash];
+            if (!visited_domains.insert(domain.id).second) continue;
+            GroundTheorem ground(rule);
+            for (size_t vi = 0; vi < domain.valuations.size(); ++vi) {
+                ground.assign(domain.valuations[vi]);
+                if (filter.keeps(ground.node)) {
+                    visit(ground.node);
+                }
+            }
+        }
+    };
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " INPUT OUTPUT_DIR " << FLATTEN_OPTIONS_USAGE << "\n"
+                "       [--string-memory-budget MB] [--profile PATH] [--locality-order]\n";
+        cerr << RECOMPRESS_OPTIONS_USAGE;
+        return 1;
+    }
+    FlattenOptions flatten_options;
+    RecompressOptions recompress_options;
+    for (int i = 3; i < argc; ++i) {
+        if (!parse_flatten_option(argc, argv, i, flatten_options)
+                && !parse_recompress_option(argc, argv, i, recompress_options)) {
+            cerr << "unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (flatten_options.align.resume && flatten_options.align.checkpoint_path.empty()) {
+        cerr << "--resume needs --checkpoint PATH" << endl;
+        return 1;
+    }
+    vector<HighNode> rules;
+    if (!ground_rules(argv[1], flatten_options, rules)) {
+        print_solved_theorems(rules, string(argv[2]) + ".partial", flatten_options.align.threads_n);
+        return EXIT_OVER_MEMORY_BUDGET;
+    }
+    recompress(ground_theorem_source(rules), argv[2], recompress_options);
+    for (const auto &fo: globals().domain_map) {
+        delete fo.second;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+#include "aligner.hpp"
+
+// The sort-split join of _Aligner::compute with the number of sources N
+// and the number of vars V known at compile time. Bounds of a level are
+// a fixed array on the call stack instead of an IndexBound on the bounds
+// stack, keys are read straight from the rows and output rows are copies
+// of a row with the constants of domain_filling_pattern, var values
+// written over it. Rows come out in a different order than from compute.
+template <int N, int V>
+struct SplitKernel {
+    typedef array<pair<int, int>, N> Bounds;
+
+    _Aligner &ali;
+    const AlignmentInfo &ai;
+    array<const short*, N> source_items;
+    array<int, N> source_widths;
+    array<int*, N> indices;
+    array<int, V> var_values;
+    vector<short> row_template;
+    vector<pair<int, int>> var_columns; // output column, var
+
+    explicit SplitKernel(_Aligner &_ali) : ali(_ali), ai(*_ali.ai) {
+        assert(ali.sentences_n() == N && ali.vars_n() == V);
+    }
+
+    void run() {
+        if (!ali.prepare_indices()) {
+            return;
+        }
+        ali.initialize_banned_var_values();
+        Bounds bounds;
+        for (int sentence_i = 0; sentence_i < N; ++sentence_i) {
+            const ValuationRows &rows = *ali.sources_valuations[sentence_i];
+            source_items[sentence_i] = rows.items.data();
+            source_widths[sentence_i] = rows.width;
+            indices[sentence_i] = ali.indices[sentence_i].begin();
+            bounds[sentence_i] = make_pair(0, (int)ali.indices[sentence_i].size);
+        }
+        for (size_t column = 0; column < ai.domain_filling_pattern.size; ++column) {
+            const int vi = ai.domain_filling_pattern[column];
+            assert(vi != 0);
+            row_template.push_back(vi > 0 ? 0 : -vi - 1);
+            if (vi > 0) {
+                var_columns.push_back(make_pair(column, vi - 1));
+            }
+        }
+        join(0, bounds);
+    }
+
+private:
+    int key(const VarOccurence &occurence, int position) const {
+        const int sentence_i = occurence.sentence;
+        return source_items[sentence_i][
+            (size_t)indices[sentence_i][position] * source_widths[sentence_i] + occurence.index];
+    }
+
+    void emit() {
+        short *row = ali.append_valuation();
+        copy(row_template.begin(), row_template.end(), row);
+        for (const auto &var_column: var_columns) {
+            row[var_column.first] = var_values[var_column.second];
+        }
+    }
+
+    void join(int level, const Bounds &bounds) {
+        const int var_id = ali.binding_order[level];
+        const auto &var_info = ai.var_infos[var_id];
+        const auto &occurences = var_info.key_occurences;
+        const auto &banned_values = ali.banned_var_values[var_id];
+        assert(occurences.size > 0);
+        for (const auto &occurence: occurences) {
+            // the first split of a sentence can come presorted
+            if (ali.presorted_columns[occurence.sentence] == occurence.index) continue;
+            const auto &bound = bounds[occurence.sentence];
+            int *sindices = indices[occurence.sentence];
+            sort(sindices + bound.first, sindices + bound.second,
+                [this, &occurence](int a, int b) -> bool {
+                    const short *items = source_items[occurence.sentence];
+                    const int width = source_widths[occurence.sentence];
+                    return items[(size_t)a * width + occurence.index]
+                        < items[(size_t)b * width + occurence.index];
+                });
+        }
+        array<int, N> processed;
+        for (int sentence_i = 0; sentence_i < N; ++sentence_i) {
+            processed[sentence_i] = bounds[sentence_i].first;
+        }
+        Bounds sub_bounds = bounds;
+        const int main = ali.main_occurences[var_id];
+        const auto &moccurence = occurences[main];
+        int &mindex = processed[moccurence.sentence];
+        const int mend = bounds[moccurence.sentence].second;
+        while (mindex < mend) {
+            const int value = key(moccurence, mindex);
+            if (banned_values.contains(value)) {
+                while (mindex < mend && key(moccurence, mindex) == value) {
+                    ++mindex;
+                }
+                continue;
+            }
+            // the main occurence goes first, so it moves past value
+            // even when another occurence has no match
+            bool bad = false;
+            for (size_t oc_i = 0; oc_i < occurences.size; ++oc_i) {
+                const auto &occurence = occurences[(main + oc_i) % occurences.size];
+                int &pi = processed[occurence.sentence];
+                const int end = bounds[occurence.sentence].second;
+                while (pi < end && key(occurence, pi) < value) ++pi;
+                const int first = pi;
+                while (pi < end && key(occurence, pi) == value) ++pi;
+                if (first == pi) {
+                    bad = true;
+                    break;
+                }
+                sub_bounds[occurence.sentence] = make_pair(first, pi);
+            }
+            if (bad) continue;
+            ++ali.actual_bindings[level];
+            var_values[var_id] = value;
+            if (level + 1 == V) {
+                emit();
+                continue;
+            }
+            for (int dvar_id: var_info.different_than) {
+                ali.banned_var_values[dvar_id].append(value);
+            }
+            join(level + 1, sub_bounds);
+            for (int dvar_id: var_info.different_than) {
+                ali.banned_var_values[dvar_id].pop();
+            }
+        }
+    }
+};
+
+template <int N, int V>
+void run_split_kernel(_Aligner &ali) {
+    SplitKernel<N, V>(ali).run();
+}
+
+typedef void (*JoinKernel)(_Aligner &ali);
+
+const int MAX_KERNEL_SENTENCES = 4;
+const int MAX_KERNEL_VARS = 4;
+
+// nullptr if there is no kernel for the shape
+inline JoinKernel split_kernel(int sentences_n, int vars_n) {
+    static const JoinKernel kernels[MAX_KERNEL_SENTENCES][MAX_KERNEL_VARS] = {
+        {&run_split_kernel<1, 1>, &run_split_kernel<1, 2>, &run_split_kernel<1, 3>, &run_split_kernel<1, 4>},
+        {&run_split_kernel<2, 1>, &run_split_kernel<2, 2>, &run_split_kernel<2, 3>, &run_split_kernel<2, 4>},
+        {&run_split_kernel<3, 1>, &run_split_kernel<3, 2>, &run_split_kernel<3, 3>, &run_split_kernel<3, 4>},
+        {&run_split_kernel<4, 1>, &run_split_kernel<4, 2>, &run_split_kernel<4, 3>, &run_split_kernel<4, 4>},
+    };
+    if (sentences_n < 1 || sentences_n > MAX_KERNEL_SENTENCES
+            || vars_n < 1 || vars_n > MAX_KERNEL_VARS) {
+        return nullptr;
+    }
+    return kernels[sentences_n - 1][vars_n - 1];
+}
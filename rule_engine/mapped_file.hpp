@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Read-only mapping of a whole file, unmapped when destroyed.
+struct MappedFile {
+    const char *data;
+    size_t size;
+
+    explicit MappedFile(const string &path) {
+        data = nullptr;
+        size = 0;
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw runtime_error("can't open file: " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            throw runtime_error("can't open file: " + path);
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("can't map file: " + path);
+            }
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            data = (const char*)mapped;
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) {
+            munmap((void*)data, size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+// Offsets where chunks of about chunk_bytes start, each chunk ends at a
+// line end, the last offset is the file size. Chunks are in file order.
+inline vector<size_t> line_chunk_bounds(const MappedFile &file, size_t chunk_bytes) {
+    vector<size_t> res;
+    size_t begin = 0;
+    while (begin < file.size) {
+        res.push_back(begin);
+        const size_t from = min(file.size, begin + chunk_bytes) - 1;
+        const void *line_end = memchr(file.data + from, '\n', file.size - from);
+        begin = line_end ? (const char*)line_end - file.data + 1 : file.size;
+    }
+    res.push_back(file.size);
+    return res;
+}
+
+// Calls process_line(line, length) for every line in [begin, end), split
+// like getline splits them.
+template <typename ProcessLine>
+void for_each_line(const char *begin, const char *end, ProcessLine process_line) {
+    while (begin < end) {
+        const char *line_end = (const char*)memchr(begin, '\n', end - begin);
+        if (!line_end) {
+            line_end = end;
+        }
+        process_line(begin, line_end - begin);
+        begin = line_end + 1;
+    }
+}
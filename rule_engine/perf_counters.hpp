@@ -0,0 +1,59 @@
+#pragma once
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Hardware event counter of the calling thread (linux perf_event).
+// If the kernel doesn't allow counting (no PMU in a VM, restrictive
+// perf_event_paranoid) available() is false and value() returns -1.
+struct PerfCounter {
+    int fd;
+
+    PerfCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~PerfCounter() {
+        if (available()) {
+            close(fd);
+        }
+    }
+
+    bool available() const {
+        return fd >= 0;
+    }
+
+    void reset() {
+        if (!available()) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    }
+
+    // counting can be started and stopped many times, counts accumulate
+    void start() {
+        if (!available()) return;
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    void stop() {
+        if (!available()) return;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    long long value() const {
+        if (!available()) return -1;
+        long long res;
+        if (read(fd, &res, sizeof(res)) != sizeof(res)) return -1;
+        return res;
+    }
+};
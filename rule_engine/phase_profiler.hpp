@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cassert>
+#include <stdexcept>
+#include <sys/resource.h>
+
+using namespace std;
+
+// Collects wall time, peak RSS growth and arbitrary counters for
+// consecutive phases of a tool and saves them as a JSON report.
+struct PhaseProfiler {
+    struct Phase {
+        string name;
+        double wall_seconds;
+        long peak_rss_kb;
+        long peak_rss_delta_kb;
+        vector<pair<string, long long>> counts;
+    };
+
+    vector<Phase> phases;
+    chrono::steady_clock::time_point phase_start;
+    long phase_start_peak_rss_kb;
+    bool in_phase;
+
+    PhaseProfiler() {
+        in_phase = false;
+    }
+
+    static long peak_rss_kb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    void start(const string &name) {
+        assert(!in_phase);
+        in_phase = true;
+        phases.push_back(Phase());
+        phases.back().name = name;
+        phase_start_peak_rss_kb = peak_rss_kb();
+        phase_start = chrono::steady_clock::now();
+    }
+
+    void count(const string &key, long long value) {
+        assert(!phases.empty());
+        phases.back().counts.push_back(make_pair(key, value));
+    }
+
+    void stop() {
+        assert(in_phase);
+        in_phase = false;
+        auto &phase = phases.back();
+        phase.wall_seconds = chrono::duration<double>(
+                chrono::steady_clock::now() - phase_start).count();
+        phase.peak_rss_kb = peak_rss_kb();
+        phase.peak_rss_delta_kb = phase.peak_rss_kb - phase_start_peak_rss_kb;
+    }
+
+    void save_json(const string &output_path) const {
+        assert(!in_phase);
+        ofstream out(output_path);
+        if (!out) {
+            throw runtime_error("can't open file: " + output_path);
+        }
+        out << "{\n  \"phases\": [\n";
+        for (size_t i = 0; i < phases.size(); ++i) {
+            const auto &phase = phases[i];
+            out << "    {\"name\": \"" << phase.name << "\""
+                << ", \"wall_seconds\": " << phase.wall_seconds
+                << ", \"peak_rss_kb\": " << phase.peak_rss_kb
+                << ", \"peak_rss_delta_kb\": " << phase.peak_rss_delta_kb;
+            for (const auto &kv: phase.counts) {
+                out << ", \"" << kv.first << "\": " << kv.second;
+            }
+            out << "}" << (i + 1 < phases.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
@@ -12,9 +12,11 @@ struct pair_hash {
     }
 };
 
-void Propnet::load(const string &dir) {
-    PropnetData::load(dir + '/' + OutputSuffix::PROPNET_DATA, identity_mapper, identity_mapper);
-    load_sentence_infos(dir + '/' + OutputSuffix::TYPES_AND_PAIRINGS, identity_mapper, sentence_infos);
+void Propnet::load(const string &dir, int deps_encoding) {
+    PropnetData::load(dir + '/' + OutputSuffix::PROPNET_DATA, identity_mapper, identity_mapper,
+                      deps_encoding);
+    load_sentence_infos(dir + '/' + OutputSuffix::TYPES_AND_PAIRINGS, identity_mapper, sentence_infos,
+                        &type_ranges);
     di.load(dir + '/' + OutputSuffix::DEBUG_INFO);
 }
 
@@ -31,7 +33,7 @@ void Propnet::reset() {
         shook.true_counter = 0;
         shook.value = UNDECIDED;
         if (sentence_id == 73) cerr << shook.counter_max << endl;
-        if (is_input_type(sentence_infos[sentence_id].type)) {
+        if (is_input(sentence_id)) {
             assert(shook.counter_max == 0);
             propagation_queue.push(sentence_id);
             shook.value = NEGATIVE;
@@ -61,8 +63,7 @@ void Propnet::reset() {
         assert(shook.value == POSITIVE || shook.value == NEGATIVE);
         const int new_value = shook.value;
 
-        for (int depit = shook.offset; depit < shook.n_deps + shook.offset; ++depit) {
-            const int dep_theo_id = deps_data[depit];
+        for_each_dep(shook, [&](const int dep_theo_id) {
             const int theo_id = abs(dep_theo_id);
             const bool first_visit_theo = !was_visited_theo[theo_id];
             was_visited_theo[theo_id] = true;
@@ -119,7 +120,7 @@ void Propnet::reset() {
             }
             assert(thook.partially_is_valid());
             assert(sub_shook.partially_is_valid());
-        }
+        });
     }
 
     for (int sentence_id = 1; sentence_id < (int)sentence_hooks.size(); ++sentence_id) {
@@ -147,7 +148,7 @@ void Propnet::run(const vector<int> &delta_input, vector<int> &delta_output) {
             assert(0);
         }
         if (sentence_hooks[sentence_id].value != new_value) {
-            assert(is_input_type(sentence_infos[sentence_id].type));
+            assert(is_input(sentence_id));
             sentence_hooks[sentence_id].value = new_value;
             propagation_queue.push(sentence_id);
         }
@@ -160,14 +161,12 @@ void Propnet::run(const vector<int> &delta_input, vector<int> &delta_output) {
         assert(shook.value == POSITIVE || shook.value == NEGATIVE);
         assert(shook.is_valid());
         const int new_value = shook.value;
-        const int stype = sentence_infos[sentence_id].type;
-        if (is_output_type(stype) || stype == SENTENCE_TYPE::LEGAL) {
-            assert(stype == SENTENCE_TYPE::LEGAL || shook.n_deps == 0);
+        if (is_reported(sentence_id)) {
+            assert(sentence_infos[sentence_id].type == SENTENCE_TYPE::LEGAL || shook.n_deps == 0);
             output_values[sentence_id] = new_value;
         }
 
-        for (int depit = shook.offset; depit < shook.n_deps + shook.offset; ++depit) {
-            const int theo_id = deps_data[depit];
+        for_each_dep(shook, [&](const int theo_id) {
             auto &thook = theorem_hooks[abs(theo_id)];
             auto &sub_shook = sentence_hooks[thook.sentence_id];
             bool reduce = (theo_id < 0 && new_value == POSITIVE) || 
@@ -199,7 +198,7 @@ void Propnet::run(const vector<int> &delta_input, vector<int> &delta_output) {
             }
             assert(sub_shook.is_valid());
             assert(thook.is_valid());
-        }
+        });
     }
     for (const auto &kv: output_values) {
         const int sentence_id = kv.first;
@@ -214,10 +213,15 @@ void Propnet::run(const vector<int> &delta_input, vector<int> &delta_output) {
 
 void Propnet::list_all_true_outputs(vector<int> &output) {
     output.resize(0);
-    for (int sentence_id = 1; sentence_id < (int)sentence_infos.size(); ++sentence_id) {
-        const int stype = sentence_infos[sentence_id].type;
+    int begin = 1;
+    int end = sentence_infos.size();
+    if (type_ranges.known()) {
+        begin = type_ranges.reported_begin();
+        end = type_ranges.reported_end();
+    }
+    for (int sentence_id = begin; sentence_id < end; ++sentence_id) {
         const auto &shook = sentence_hooks[sentence_id];
-        if ((stype == SENTENCE_TYPE::LEGAL || is_output_type(stype)) && shook.any_true()) {
+        if (is_reported(sentence_id) && shook.any_true()) {
             output.push_back(sentence_id);
         }
     }
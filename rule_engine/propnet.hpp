@@ -6,9 +6,14 @@ using namespace std;
 
 struct Propnet: private PropnetData {
     vector<SentenceInfo> sentence_infos;
+    SentenceTypeRanges type_ranges; // not known for files from older recompressor
     DebugInfo di;
 
-    void load(const string &dir);
+    // deps_encoding - DEPS_ENCODING::PACKED trades some run speed for memory
+    void load(const string &dir, int deps_encoding=DEPS_ENCODING::PLAIN);
+    size_t deps_memory_bytes() const {
+        return PropnetData::deps_memory_bytes();
+    }
     void reset();
 
     // list of positive id if true, negative if flase, included only if changed from last time
@@ -16,5 +21,20 @@ struct Propnet: private PropnetData {
              vector<int> &delta_output);
     void list_all_true_outputs(vector<int> &true_sentences_output);
 private:
+    bool is_reported(int sentence_id) const {
+        if (type_ranges.known()) {
+            return sentence_id >= type_ranges.reported_begin() &&
+                   sentence_id < type_ranges.reported_end();
+        }
+        const int stype = sentence_infos[sentence_id].type;
+        return is_output_type(stype) || stype == SENTENCE_TYPE::LEGAL;
+    }
+    bool is_input(int sentence_id) const {
+        if (type_ranges.known()) {
+            return type_ranges.contains(SENTENCE_TYPE::TRUE, sentence_id) ||
+                   type_ranges.contains(SENTENCE_TYPE::DOES, sentence_id);
+        }
+        return is_input_type(sentence_infos[sentence_id].type);
+    }
     bool operator==(const Propnet &p) const { return false;}
 };
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <unordered_set>
 #include <algorithm>
+#include <chrono>
 
 #ifndef NO_BACKWARD
 #define BACKWARD_HAS_DW 1
@@ -18,6 +19,7 @@ namespace backward {
 #include "tools_for_recompressed.hpp"
 #include "recompressor.hpp"
 #include "GDLTokenizer.hpp"
+#include "perf_counters.hpp"
 
 using namespace std;
 
@@ -37,7 +39,9 @@ struct TruthKeeper {
 
 DebugInfo debug_info;
 vector<SentenceInfo> sentence_infos;
+SentenceTypeRanges type_ranges;
 vector<vector<int>> delta_states, delta_inputs;
+vector<vector<int>> moves;  // sorted does sentences of every input line
 vector<int> initial_input;  // all sentences listed in init should be set to true
 
 void split_by_dollar(const string &s, vector<string> &output) {
@@ -71,7 +75,12 @@ vector<int> true_into_next(const vector<int> &differential) {
     for (int i = 0; i < (int)differential.size(); ++i) {
         const int sentence_id = differential[i];
         const auto &sinfo = sentence_infos[abs(sentence_id)];
-        if (sinfo.type == SENTENCE_TYPE::TRUE) {
+        if (type_ranges.known()) {
+            if (type_ranges.contains(SENTENCE_TYPE::TRUE, abs(sentence_id))) {
+                res[i] = sentence_id + sgn(sentence_id) * type_ranges.true_to_next_offset();
+                assert(abs(res[i]) == sinfo.equivalent_id);
+            }
+        } else if (sinfo.type == SENTENCE_TYPE::TRUE) {
             assert(sinfo.equivalent_id != -1);
             res[i] = sgn(sentence_id) * sinfo.equivalent_id;
         } 
@@ -120,7 +129,8 @@ void load_recompressed(const string &recompressed_path) {
     load_sentence_infos(
         recompressed_path + "/" + OutputSuffix::TYPES_AND_PAIRINGS, 
         identity_mapper,
-        sentence_infos
+        sentence_infos,
+        &type_ranges
     );
 
     initial_input.resize(0);
@@ -135,6 +145,7 @@ void load_recompressed(const string &recompressed_path) {
 void load_test_data(const string &test_file_path) {
     delta_states.resize(0);
     delta_inputs.resize(0);
+    moves.resize(0);
     ifstream inputf(test_file_path);
     if (!inputf) {
         throw runtime_error("file: " + test_file_path + " does not exist.");
@@ -158,6 +169,7 @@ void load_test_data(const string &test_file_path) {
             assert(reading_state == DONE_MOVES);
             input = strip_legal(state);
             strings_to_ids(splitted, input_helper);
+            moves.push_back(input_helper);
             input.insert(input.end(), input_helper.begin(), input_helper.end());
             delta_inputs.push_back(state_differential(last_input, input));
             last_input = input;
@@ -167,15 +179,90 @@ void load_test_data(const string &test_file_path) {
     cerr << "hmm: " << delta_states.size() << " " << delta_inputs.size() << endl;
 }
 
+// every player with moves does exactly one of them
+void check_one_move_per_player(const vector<int> &state_moves) {
+    if (!type_ranges.known()) {
+        return;
+    }
+    const auto &player_begin = type_ranges.does_player_begin;
+    for (int player_id = 0; player_id + 1 < (int)player_begin.size(); ++player_id) {
+        const int begin = player_begin[player_id], end = player_begin[player_id + 1];
+        if (begin == end) {
+            continue;
+        }
+        const int player_moves = upper_bound(state_moves.begin(), state_moves.end(), end - 1) -
+                                 lower_bound(state_moves.begin(), state_moves.end(), begin);
+        assert(player_moves == 1);
+    }
+}
+
+void measure_runs(Propnet &propnet, int repetitions) {
+    // replays test data and counts cache events in Propnet::run only
+    PerfCounter cache_references(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+    PerfCounter cache_misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    PerfCounter l1d_misses(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    vector<int> delta_output;
+    chrono::duration<double> run_time(0);
+    long long run_calls = 0;
+    for (int rep = 0; rep < repetitions; ++rep) {
+        propnet.reset();
+        for (int i = -1; i < (int)delta_inputs.size(); ++i) {
+            const auto &delta_input = i == -1 ? initial_input : delta_inputs[i];
+            const auto start = chrono::steady_clock::now();
+            cache_references.start();
+            cache_misses.start();
+            l1d_misses.start();
+            propnet.run(delta_input, delta_output);
+            l1d_misses.stop();
+            cache_misses.stop();
+            cache_references.stop();
+            run_time += chrono::steady_clock::now() - start;
+            ++run_calls;
+        }
+    }
+    cout << "run calls: " << run_calls << "\n";
+    cout << "run seconds: " << run_time.count() << "\n";
+    if (!cache_references.available()) {
+        cout << "hardware counters unavailable" << endl;
+        return;
+    }
+    cout << "cache references: " << cache_references.value() << "\n";
+    cout << "cache misses: " << cache_misses.value() << "\n";
+    cout << "cache miss rate: " <<
+        (double)cache_misses.value() / max(1LL, cache_references.value()) << "\n";
+    cout << "L1d read misses: " << l1d_misses.value() << endl;
+}
+
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        cerr << "usage: " << argv[0] << " INPUT_FILE RECOMPRESSED_PROPNET_PATH" << endl;
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " INPUT_FILE RECOMPRESSED_PROPNET_PATH [--measure REPETITIONS]"
+                " [--packed-deps]" << endl;
+        cerr << "  --measure REPETITIONS - after checking, replay input REPETITIONS times\n"
+                "                          and report time and cache misses of run\n"
+                "  --packed-deps         - keep dependencies packed as varint deltas" << endl;
         return 0;
     }
     string test_file_path = argv[1];
     string recompressed_propnet_path = argv[2];
+    int measure_repetitions = 0;
+    int deps_encoding = DEPS_ENCODING::PLAIN;
+    for (int i = 3; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--measure" && i + 1 < argc) {
+            measure_repetitions = stoi(argv[++i]);
+        } else if (arg == "--packed-deps") {
+            deps_encoding = DEPS_ENCODING::PACKED;
+        } else {
+            cerr << "unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
     Propnet propnet;
-    propnet.load(recompressed_propnet_path);
+    propnet.load(recompressed_propnet_path, deps_encoding);
+    cout << "deps memory: " << propnet.deps_memory_bytes() << " bytes" << endl;
     load_recompressed(recompressed_propnet_path);
     load_test_data(test_file_path);
     assert(delta_states.size() == delta_inputs.size() + 1);
@@ -189,10 +276,14 @@ int main(int argc, char **argv) {
     propnet_tk.update(delta_output);
     assert(source_tk.are_true == propnet_tk.are_true);
     for (int i = 0; i < (int)delta_inputs.size(); ++i) {
+        check_one_move_per_player(moves[i]);
         propnet.run(delta_inputs[i], delta_output);
         propnet_tk.update(delta_output);
         source_tk.update(delta_states[i + 1]);
         assert(propnet_tk.are_true == source_tk.are_true);
     }
+    if (measure_repetitions > 0) {
+        measure_runs(propnet, measure_repetitions);
+    }
     return 0;
 }
@@ -32,7 +32,7 @@ int main(int argc, char **argv) {
     auto smapper2_to_1 = consensus_mapper_generator(
             di1.sentence_ids, di2.sentence_id_to_str);
     auto tmapper2_to_1 = consensus_mapper_generator(
-            di2.theorem_ids, di2.theorem_id_to_str);
+            di1.theorem_ids, di2.theorem_id_to_str);
     vector<SentenceInfo> sentence_infos1, sentence_infos2;
     load_sentence_infos(inpf2 + OutputSuffix::TYPES_AND_PAIRINGS, smapper2_to_1, sentence_infos2);
     load_sentence_infos(inpf1 + OutputSuffix::TYPES_AND_PAIRINGS, identity_mapper, sentence_infos1);
@@ -2,23 +2,18 @@
 #include <fstream>
 #include <unordered_map>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
-
-#ifndef NO_BACKWARD
-#define BACKWARD_HAS_DW 1
-#include "backward.hpp"
-
-namespace backward {
-    backward::SignalHandling sh;
-};
-
-#endif
-
+#include <thread>
 
 using namespace std;
 #include "common.hpp"
 #include "HighNode.hpp"
 #include "recompressor.hpp"
+#include "string_table.hpp"
+#include "phase_profiler.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
 
 
 struct TheoremData {
@@ -38,19 +33,19 @@ struct SentenceData {
     int valid_is_head_of_counter;
 };
 
-string input_path;
-
 namespace OutputPaths {
     string debug_info, propnet_data, backtrack_data, types_and_pairings;
 };
 
 int NOT_TOKEN_ID, DISTINCT_TOKEN_ID, NEXT_TOKEN_ID, LEGAL_TOKEN_ID;
 
-unordered_map<string, int> sentence_ids;
-vector<string> sentence_id_to_str;
+// Sentences and theorems are kept as keys (see append_node_key), sentence
+// keys are looked up through the table's own hash index. Their texts are
+// built only for debug_info.
+StringTable sentence_id_to_str;
 
 unordered_map<int, int> value_to_theo_type;
-vector<string> theorem_id_to_str;
+StringTable theorem_id_to_str;
 
 vector<SentenceInfo> sentence_infos;
 vector<SentenceData> sentence_datas;
@@ -62,7 +57,14 @@ vector<bool> debug_always_false_theorem;
 vector<bool> debug_always_true_theorem;
 vector<bool> const_theos, const_sentences;
 vector<int> theorem_remap, sentence_remap;
+vector<int> theorem_order, sentence_order; // kept ids sorted by their new ids
+bool locality_order = false;
+SentenceTypeRanges type_ranges;
 unordered_map<int, int> token_to_player_id;
+PhaseProfiler profiler;
+// counters of the phases are full passes, they are taken only with
+// --profile and outside the timed part of a phase
+bool profiling = false;
 
 int upper_sentence_id() {
     return sentence_id_to_str.size();
@@ -72,6 +74,30 @@ int upper_theorem_id() {
     return theorem_id_to_str.size();
 }
 
+long long count_edges() {
+    long long res = 0;
+    for (const auto &sdata: sentence_datas) {
+        res += sdata.containing_theorem_ids.size();
+    }
+    return res;
+}
+
+// valid after find_ids_to_remove
+long long count_kept_edges() {
+    long long res = 0;
+    for (int sentence_id = 1; sentence_id < upper_sentence_id(); ++sentence_id) {
+        if (const_sentences[sentence_id]) continue;
+        for (int theo_id: sentence_datas[sentence_id].containing_theorem_ids) {
+            if (!const_theos[abs(theo_id)]) ++res;
+        }
+    }
+    return res;
+}
+
+long long count_kept(const vector<bool> &removed) {
+    return removed.size() - 1 - count(removed.begin() + 1, removed.end(), true);
+}
+
 void initialize_global_token_ids() {
     NOT_TOKEN_ID = str_token_to_int("not"); 
     DISTINCT_TOKEN_ID = str_token_to_int("distinct");
@@ -135,32 +161,110 @@ void get_equivalent_sentence_node(const HighNode &node, HighNode &res) {
     res.value = equivalent_token_id;
 }
 
-int get_player_id(const HighNode &node) {
-    // player ids are from 1 to NP, where NP is the number of players
-    int stype = get_sentence_type(node);
-    assert(stype == SENTENCE_TYPE::LEGAL || stype == SENTENCE_TYPE::DOES);
-    assert(node.sub.size() > 1);
-    assert(node.sub[0].type == TYPE::CONST);
-    const int player_id_token = node.sub[0].value;
-    if (token_to_player_id.count(player_id_token) == 0) {
-        const int new_id = token_to_player_id.size() + 1;
-        token_to_player_id[player_id_token] = new_id;
+namespace NODE_KEY {
+    enum {
+        LEAF = -1, // in place of the number of arguments
+        THEOREM = -2, // in place of the symbol
+    };
+};
+
+static void append_key_int(string &key, int value) {
+    key.append((const char*)&value, sizeof(int));
+}
+
+static int key_int(const string &key, size_t &pos) {
+    int res;
+    memcpy(&res, key.data() + pos, sizeof(int));
+    pos += sizeof(int);
+    return res;
+}
+
+// symbol id of the node and the number of its arguments, then arguments
+// the same way, a variable or a constant is its id and NODE_KEY::LEAF
+static void append_node_key(const HighNode &node, string &key) {
+    append_key_int(key, node.type == TYPE::THEOREM ? (int)NODE_KEY::THEOREM : node.value);
+    append_key_int(key, node.sub.size());
+    for (const auto &sub: node.sub) {
+        if (sub.type == TYPE::VAR || sub.type == TYPE::CONST) {
+            append_key_int(key, sub.value);
+            append_key_int(key, NODE_KEY::LEAF);
+        } else {
+            append_node_key(sub, key);
+        }
+    }
+}
+
+string node_key(const HighNode &node) {
+    string res;
+    append_node_key(node, res);
+    return res;
+}
+
+static void append_key_text(const string &key, size_t &pos, string &text) {
+    const auto &names = globals().reverse_numeric_rename;
+    const int value = key_int(key, pos);
+    const int args_n = key_int(key, pos);
+    text += value == NODE_KEY::THEOREM ? "( <=" : "( " + names[value];
+    for (int i = 0; i < args_n; ++i) {
+        size_t arg_pos = pos;
+        const int arg_value = key_int(key, arg_pos);
+        if (key_int(key, arg_pos) == NODE_KEY::LEAF) {
+            text += " " + names[arg_value];
+            pos = arg_pos;
+        } else {
+            text += " ";
+            append_key_text(key, pos, text);
+        }
+    }
+    text += " )";
+}
+
+// the same text as HighNode::to_string of the node
+string key_text(const string &key) {
+    string res;
+    size_t pos = 0;
+    append_key_text(key, pos, res);
+    assert(pos == key.size());
+    return res;
+}
+
+// Players get their ids from 1 to NP by the names of their tokens,
+// whatever the order of rules is. Until then does and legal sentences
+// keep the token of their player as player_id.
+void number_players() {
+    const auto &names = globals().reverse_numeric_rename;
+    vector<int> player_tokens;
+    for (const auto &sinfo: sentence_infos) {
+        if (is_with_player_type(sinfo.type)) {
+            player_tokens.push_back(sinfo.player_id);
+        }
+    }
+    sort(player_tokens.begin(), player_tokens.end(), [&names](int a, int b) -> bool {
+        return names[a] < names[b];
+    });
+    player_tokens.erase(unique(player_tokens.begin(), player_tokens.end()), player_tokens.end());
+    for (size_t i = 0; i < player_tokens.size(); ++i) {
+        token_to_player_id[player_tokens[i]] = i + 1;
+    }
+    for (auto &sinfo: sentence_infos) {
+        if (is_with_player_type(sinfo.type)) {
+            sinfo.player_id = token_to_player_id[sinfo.player_id];
+        }
     }
-    return token_to_player_id[player_id_token];
 }
 
 
 int get_or_create_sentence_id(const HighNode &node) {
-    const string sentence_str = node.to_string();
-    if (sentence_ids.count(sentence_str) == 0) {
+    const string key = node_key(node);
+    int sentence_id = sentence_id_to_str.find(key);
+    if (sentence_id == -1) {
         const int sentence_type = get_sentence_type(node);
-        const int sentence_id = sentence_ids.size() + 1;
-        sentence_ids[sentence_str] = sentence_id;
-        assert((int)sentence_id_to_str.size() == sentence_id);
-        sentence_id_to_str.push_back(sentence_str);
+        sentence_id = sentence_id_to_str.push_back(key);
         int player_id = -1;
-        if (sentence_type == SENTENCE_TYPE::DOES || sentence_type == SENTENCE_TYPE::LEGAL) {
-            player_id = get_player_id(node);
+        if (is_with_player_type(sentence_type)) {
+            assert(node.sub.size() > 1);
+            assert(node.sub[0].type == TYPE::CONST);
+            player_id = node.sub[0].value; // numbered by number_players
         }
         assert((int)sentence_infos.size() == sentence_id);
         sentence_infos.push_back(SentenceInfo());
@@ -173,23 +277,70 @@ int get_or_create_sentence_id(const HighNode &node) {
         sentence_infos[sentence_id] = SentenceInfo(
                 sentence_type, player_id, equivalent_sentence_id);
     }
-    return sentence_ids[sentence_str];
+    return sentence_id;
 }
 
-void generate_ids() {
+RuleSource rule_file_source(const string &path, int threads_n) {
+    return [path, threads_n](const RuleVisitor &visit) {
+        const size_t CHUNK_BYTES = 1 << 20;
+        const MappedFile file(path);
+        const auto bounds = line_chunk_bounds(file, CHUNK_BYTES);
+        const int chunks_n = bounds.size() - 1;
+        ThreadPool pool(threads_n);
+        const int batch_chunks = pool.size() * 2;
+        // tokens of the batch being visited and of the next one
+        vector<vector<GDLToken>> ready(batch_chunks), ahead(batch_chunks);
+        auto tokenize_batch = [&](int batch_begin, vector<vector<GDLToken>> &batch_tokens) {
+            pool.run(min(batch_chunks, chunks_n - batch_begin), [&](int i, int) {
+                const int chunk = batch_begin + i;
+                FlatGDLTokens tokens;
+                batch_tokens[i].resize(0);
+                for_each_line(file.data + bounds[chunk], file.data + bounds[chunk + 1],
+                        [&](const char *line, size_t length) {
+                    tokens.input.assign(line, length);
+                    tokens.tokenize();
+                    batch_tokens[i].emplace_back();
+                    tokens.to_token(tokens.root(), batch_tokens[i].back());
+                });
+            });
+        };
+        if (chunks_n > 0) {
+            tokenize_batch(0, ready);
+        }
+        HighNode node;
+        for (int batch_begin = 0; batch_begin < chunks_n; batch_begin += batch_chunks) {
+            const int next_begin = batch_begin + batch_chunks;
+            thread tokenizer;
+            if (threads_n > 1 && next_begin < chunks_n) {
+                tokenizer = thread(tokenize_batch, next_begin, ref(ahead));
+            }
+            const int batch_end = min(chunks_n, next_begin);
+            for (int chunk = batch_begin; chunk < batch_end; ++chunk) {
+                auto token = ready[chunk - batch_begin].begin();
+                for_each_line(file.data + bounds[chunk], file.data + bounds[chunk + 1],
+                        [&](const char *line, size_t length) {
+                    node.fill_from_token(*token++);
+                    visit(node);
+                });
+                vector<GDLToken>().swap(ready[chunk - batch_begin]);
+            }
+            if (tokenizer.joinable()) {
+                tokenizer.join();
+            } else if (next_begin < chunks_n) {
+                tokenize_batch(next_begin, ahead);
+            }
+            ready.swap(ahead);
+        }
+    };
+}
+
+int generate_ids(const RuleSource &rules) {
     initialize_global_token_ids();
     prepare_value_to_theo_type_map();
-    ifstream inpf(input_path);
-
-    GDLToken token;
-    string line;
-    HighNode node;
     sentence_id_to_str.push_back("$NOPE$!!!");
     sentence_infos.push_back(SentenceInfo(-1));
     int done_counter = 0;
-    while (getline(inpf, line)) {
-        GDLTokenizer::tokenize_str(line, token);
-        node.fill_from_token(token);
+    rules([&done_counter](HighNode &node) {
         for (int i = 0; i < (int)node.sub.size(); ++i) {
             HighNode &not_not_node = not_stripper(node.sub[i]);
             const int sentence_type = get_sentence_type(not_not_node);
@@ -202,7 +353,9 @@ void generate_ids() {
         ++done_counter;
         if (done_counter % 10000 == 0)
             cerr << "done lines n: " << done_counter << endl;
-    }
+    });
+    number_players();
+    return done_counter;
 }
 
 namespace SUB_SENTENCE_FLAG  {
@@ -235,33 +388,27 @@ int get_sub_sentence_id(const HighNode &snode, int &flag) {
         }
         return ret;
     }
-    const string snode_string = snode.to_string();
-    if (sentence_ids.count(snode_string) == 0) {
+    const int sentence_id = sentence_id_to_str.find(node_key(snode));
+    if (sentence_id == -1) {
         flag = SUB_SENTENCE_FLAG::ALWAYS_FALSE;
         return 0;
     } else {
         flag = SUB_SENTENCE_FLAG::NORMAL;
-        return sentence_ids[snode.to_string()];
+        return sentence_id;
     }
 }
 
-void load_theorems() {
+void load_theorems(const RuleSource &rules) {
     // removes distinct - it should be always true anyways
     sentence_datas.resize(upper_sentence_id());
     theorem_datas.resize(0);
     theorem_datas.push_back(TheoremData());
-    theorem_id_to_str.resize(0);
+    assert(theorem_id_to_str.size() == 0);
     theorem_id_to_str.push_back("!$!!!NOPE_THEOREM!$!!!");
-    ifstream inpf(input_path);
-    GDLToken token;
-    string line;
     int theorem_id = 1;
-    while (getline(inpf, line)) {
-        GDLTokenizer::tokenize_str(line, token);
-        HighNode node;
-        node.fill_from_token(token);
-        int head_id = sentence_ids[node.sub[0].to_string()];
-        if (head_id == 0) {
+    rules([&theorem_id](HighNode &node) {
+        int head_id = sentence_id_to_str.find(node_key(node.sub[0]));
+        if (head_id <= 0) {
             cerr << node.sub[0].to_string() << endl;
         }
         assert(head_id > 0);
@@ -299,10 +446,10 @@ void load_theorems() {
         theorem_to_fill.counter_max = forward_counter;
         theorem_to_fill.counter_value = 0;
         theorem_to_fill.always_false = always_false;
-        theorem_id_to_str.push_back(line);
+        theorem_id_to_str.push_back(node_key(node));
         ++theorem_id;
         assert((int)theorem_id_to_str.size() == theorem_id);
-    }
+    });
 }
 
 void find_ids_to_remove() {
@@ -422,15 +569,35 @@ void find_ids_to_remove() {
     }
 }
 
-void collect_and_filter_prop_net_data() {
+void compute_remaps();
+
+void collect_and_filter_prop_net_data(const RuleSource &rules) {
     // remove const normal which, assert there is no always true does
     // if there is const legal, terminal, goal, init or next- leave it
     // remove distinct (because it is always true)
     cerr << "loading theorems" << endl;
-    load_theorems();
+    profiler.start("load_theorems");
+    profiler.count("sentences_in", upper_sentence_id() - 1);
+    load_theorems(rules);
+    profiler.stop();
+    const long long edges = profiling ? count_edges() : 0;
+    if (profiling) {
+        profiler.count("theorems_out", upper_theorem_id() - 1);
+        profiler.count("edges_out", edges);
+    }
 
     cerr << "starting propagation" << endl;
+    profiler.start("find_ids_to_remove");
+    profiler.count("sentences_in", upper_sentence_id() - 1);
+    profiler.count("theorems_in", upper_theorem_id() - 1);
+    profiler.count("edges_in", edges);
     find_ids_to_remove();
+    profiler.stop();
+    if (profiling) {
+        profiler.count("sentences_out", count_kept(const_sentences));
+        profiler.count("theorems_out", count_kept(const_theos));
+        profiler.count("edges_out", count_kept_edges());
+    }
     for (int i = 1; i < (int)debug_always_true_sentence.size(); ++i) {
         assert((debug_always_true_sentence[i] || debug_always_false_sentence[i]) ==
                const_sentences[i]);
@@ -448,7 +615,7 @@ void collect_and_filter_prop_net_data() {
             assert(debug_always_false_sentence[i]);
             cerr << "false: ";
         }
-        cerr << sentence_id_to_str[i] << "\n";
+        cerr << key_text(sentence_id_to_str[i]) << "\n";
     }
     cerr << "CONST THEOREMS:\n";
     for (int i = 1; i < (int)const_theos.size(); ++i) if (const_theos[i]) {
@@ -461,55 +628,181 @@ void collect_and_filter_prop_net_data() {
             assert(debug_always_true_sentence[theorem_datas[i].head_id]);
             cerr << "pointing to const s: ";
         }
-        cerr << theorem_id_to_str[i] << "\n";
+        cerr << key_text(theorem_id_to_str[i]) << "\n";
+    }
+
+    profiler.start("remapping");
+    compute_remaps();
+    profiler.stop();
+    if (profiling) {
+        profiler.count("sentences_out", count_kept(const_sentences));
+        profiler.count("theorems_out", count_kept(const_theos));
+    }
+}
+
+void remap_from_order(const vector<int> &order, int upper_id, vector<int> &remap) {
+    remap.resize(0);
+    remap.resize(upper_id, -1);
+    for (size_t i = 0; i < order.size(); ++i) {
+        remap[order[i]] = i + 1;
+    }
+}
+
+void order_for_locality() {
+    // Cuthill-McKee like ordering of the propagation graph:
+    // sentence -> theorems containing it -> their heads.
+    // Breadth first search starts from input sentences, so gates which are
+    // reached by the same propagation wave get neighbouring ids.
+    vector<bool> sentence_seen(upper_sentence_id()), theorem_seen(upper_theorem_id());
+    vector<int> new_sentence_order, new_theorem_order;
+    vector<int> roots;
+    for (int sentence_id: sentence_order) {
+        if (is_input_type(sentence_infos[sentence_id].type)) {
+            roots.push_back(sentence_id);
+        }
     }
-    theorem_remap.resize(upper_theorem_id());
-    sentence_remap.resize(upper_sentence_id());
-    sentence_remap[0] = -1;
-    theorem_remap[0] = -1;
-    int theorem_counter = 1;
-    for (size_t theo_id = 1; theo_id < theorem_remap.size(); ++theo_id) {
+    roots.insert(roots.end(), sentence_order.begin(), sentence_order.end());
+
+    vector<int> neighbours;
+    size_t queue_begin = 0; // new_sentence_order is the bfs queue
+    for (int root: roots) {
+        if (sentence_seen[root]) continue;
+        sentence_seen[root] = true;
+        new_sentence_order.push_back(root);
+        while (queue_begin < new_sentence_order.size()) {
+            const int sentence_id = new_sentence_order[queue_begin++];
+            neighbours.resize(0);
+            for (int theo_id: sentence_datas[sentence_id].containing_theorem_ids) {
+                theo_id = abs(theo_id);
+                if (!const_theos[theo_id] && !theorem_seen[theo_id]) {
+                    theorem_seen[theo_id] = true;
+                    neighbours.push_back(theo_id);
+                }
+            }
+            stable_sort(neighbours.begin(), neighbours.end(), [](int a, int b) -> bool {
+                return sentence_datas[theorem_datas[a].head_id].containing_theorem_ids.size() <
+                       sentence_datas[theorem_datas[b].head_id].containing_theorem_ids.size();
+            });
+            for (int theo_id: neighbours) {
+                new_theorem_order.push_back(theo_id);
+                const int head_id = theorem_datas[theo_id].head_id;
+                assert(!const_sentences[head_id]);
+                if (!sentence_seen[head_id]) {
+                    sentence_seen[head_id] = true;
+                    new_sentence_order.push_back(head_id);
+                }
+            }
+        }
+    }
+    // theorems without body (init) are not reachable from any sentence
+    for (int theo_id: theorem_order) {
+        if (!theorem_seen[theo_id]) {
+            new_theorem_order.push_back(theo_id);
+        }
+    }
+    assert(new_sentence_order.size() == sentence_order.size());
+    assert(new_theorem_order.size() == theorem_order.size());
+    sentence_order.swap(new_sentence_order);
+    theorem_order.swap(new_theorem_order);
+}
+
+void group_sentences_by_type() {
+    // keeps relative order inside each type block
+    vector<vector<int>> blocks(SENTENCE_TYPE::N_SENTENCE_TYPES);
+    for (int sentence_id: sentence_order) {
+        blocks[sentence_infos[sentence_id].type].push_back(sentence_id);
+    }
+    auto &does_block = blocks[SENTENCE_TYPE::DOES];
+    stable_sort(does_block.begin(), does_block.end(), [](int a, int b) -> bool {
+        return sentence_infos[a].player_id < sentence_infos[b].player_id;
+    });
+    const pair<int, int> paired_blocks[] = {
+        make_pair(SENTENCE_TYPE::DOES, SENTENCE_TYPE::LEGAL),
+        make_pair(SENTENCE_TYPE::TRUE, SENTENCE_TYPE::NEXT),
+    };
+    for (const auto &pb: paired_blocks) {
+        // pairing is one to one, so the paired block is a permutation
+        auto &paired = blocks[pb.second];
+        assert(paired.size() == blocks[pb.first].size());
+        paired.resize(0);
+        for (int sentence_id: blocks[pb.first]) {
+            const int equivalent_id = sentence_infos[sentence_id].equivalent_id;
+            assert(sentence_infos[equivalent_id].type == pb.second);
+            assert(!const_sentences[equivalent_id]);
+            paired.push_back(equivalent_id);
+        }
+    }
+
+    sentence_order.resize(0);
+    type_ranges.type_begin.resize(0);
+    for (const auto &block: blocks) {
+        type_ranges.type_begin.push_back(sentence_order.size() + 1);
+        sentence_order.insert(sentence_order.end(), block.begin(), block.end());
+    }
+    type_ranges.type_begin.push_back(sentence_order.size() + 1);
+
+    const int players_n = token_to_player_id.size();
+    auto &player_begin = type_ranges.does_player_begin;
+    player_begin.resize(0);
+    player_begin.resize(players_n + 2, 0);
+    for (int sentence_id: does_block) {
+        ++player_begin[sentence_infos[sentence_id].player_id + 1];
+    }
+    player_begin[0] = type_ranges.begin(SENTENCE_TYPE::DOES);
+    for (int player_id = 1; player_id <= players_n + 1; ++player_id) {
+        player_begin[player_id] += player_begin[player_id - 1];
+    }
+    assert(player_begin.back() == type_ranges.end(SENTENCE_TYPE::DOES));
+}
+
+void compute_remaps() {
+    theorem_order.resize(0);
+    for (int theo_id = 1; theo_id < upper_theorem_id(); ++theo_id) {
         if (!const_theos[theo_id]) {
-            theorem_remap[theo_id] = theorem_counter++;
-        } else {
-            theorem_remap[theo_id] = -1;
+            theorem_order.push_back(theo_id);
         }
     }
-    int sentence_counter = 1;
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
+    sentence_order.resize(0);
+    for (int sentence_id = 1; sentence_id < upper_sentence_id(); ++sentence_id) {
         if (!const_sentences[sentence_id]) {
-            sentence_remap[sentence_id] = sentence_counter++;
-        } else {
-            sentence_remap[sentence_id] = -1;
+            sentence_order.push_back(sentence_id);
         }
     }
+    if (locality_order) {
+        order_for_locality();
+    }
+    group_sentences_by_type();
+    remap_from_order(theorem_order, upper_theorem_id(), theorem_remap);
+    remap_from_order(sentence_order, upper_sentence_id(), sentence_remap);
 }
 
 
+// Sections are written in the order of old ids, each one reads its string
+// table in a sequential pass. DebugInfo::load takes mappings in any order.
 void save_debug_info() {
     ofstream debug_out(OutputPaths::debug_info);
     const int T = theorem_remap.size() - count(theorem_remap.begin(), theorem_remap.end(), -1);
     const int S = sentence_remap.size() - count(sentence_remap.begin(), sentence_remap.end(), -1);
     debug_out << "#SENTENCE_MAPPING: " << S << "\n";
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
-        int new_id = sentence_remap[sentence_id];
+    sentence_id_to_str.for_each_string([&](size_t sentence_id, const string &key) {
+        int new_id = sentence_id > 0 ? sentence_remap[sentence_id] : -1;
         if (new_id != -1) {
             assert(new_id > 0);
-            debug_out << new_id << "\n" << sentence_id_to_str[sentence_id] << "\n";
+            debug_out << new_id << "\n" << key_text(key) << "\n";
         }
-    }
+    });
     debug_out << "\n#THEOREM_MAPPING: " << T << "\n";
-    for (size_t theo_id = 1; theo_id < theorem_remap.size(); ++theo_id) {
-        int new_id = theorem_remap[theo_id];
+    theorem_id_to_str.for_each_string([&](size_t theo_id, const string &key) {
+        int new_id = theo_id > 0 ? theorem_remap[theo_id] : -1;
         if (new_id != -1) {
             assert(new_id > 0);
-            debug_out << new_id << "\n" << theorem_id_to_str[theo_id] << "\n";
+            debug_out << new_id << "\n" << key_text(key) << "\n";
         }
-    }
+    });
 
     debug_out << "\n#REMOVED_SENTENCES:\n";
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
-        int new_id = sentence_remap[sentence_id];
+    sentence_id_to_str.for_each_string([&](size_t sentence_id, const string &key) {
+        int new_id = sentence_id > 0 ? sentence_remap[sentence_id] : 0;
         if (new_id == -1) {
             if (debug_always_true_sentence[sentence_id]) {
                 debug_out << "always true: ";
@@ -519,12 +812,12 @@ void save_debug_info() {
                 debug_out << "pointing to const: ";
                 assert(false);
             }
-            debug_out << sentence_id_to_str[sentence_id] << "\n";
+            debug_out << key_text(key) << "\n";
         }
-    }
+    });
     debug_out << "\n#REMOVED_THEOREMS\n";
-    for (size_t theo_id = 1; theo_id < theorem_remap.size(); ++theo_id) {
-        int new_id = theorem_remap[theo_id];
+    theorem_id_to_str.for_each_string([&](size_t theo_id, const string &key) {
+        int new_id = theo_id > 0 ? theorem_remap[theo_id] : 0;
         if (new_id == -1) {
             if (debug_always_true_theorem[theo_id]) {
                 debug_out << "always true: ";
@@ -533,9 +826,9 @@ void save_debug_info() {
             } else {
                 assert(debug_always_true_sentence[theorem_datas[theo_id].head_id]);
             }
-            debug_out << theorem_id_to_str[theo_id] << "\n";
+            debug_out << key_text(key) << "\n";
         }
-    }
+    });
 }
 
 void save_propnet_data() {
@@ -548,7 +841,7 @@ void save_propnet_data() {
     const int T = theorem_remap.size() - count(theorem_remap.begin(), theorem_remap.end(), -1);
     const int S = sentence_remap.size() - count(sentence_remap.begin(), sentence_remap.end(), -1);
     outfile << T << " " << S << "\n";
-    for (size_t theo_id = 1; theo_id < theorem_remap.size(); ++theo_id) {
+    for (int theo_id: theorem_order) {
         if (theorem_remap[theo_id] != -1) {
             assert(theorem_remap[theo_id] > 0);
             const auto &tc = theorem_datas[theo_id];
@@ -561,7 +854,7 @@ void save_propnet_data() {
             outfile << new_sentence_id << " " << new_counter_max << "\n";
         }
     }
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
+    for (int sentence_id: sentence_order) {
         if (sentence_remap[sentence_id] != -1) {
             assert(sentence_remap[sentence_id] > 0);
             const auto &deps = sentence_datas[sentence_id].containing_theorem_ids;
@@ -593,7 +886,7 @@ void save_backtrack_data() {
     const int S = sentence_remap.size() - count(sentence_remap.begin(), sentence_remap.end(), -1);
     ofstream outfile(OutputPaths::backtrack_data);
     outfile << S << "\n";
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
+    for (int sentence_id: sentence_order) {
         if (sentence_remap[sentence_id] != -1) {
             assert(sentence_remap[sentence_id] > 0);
             int valid_theorem_counter = 0;
@@ -604,7 +897,7 @@ void save_backtrack_data() {
             int stype = sentence_infos[sentence_id].type;
             if (!(valid_theorem_counter > 0 || !is_removable_type(stype))) {
                 cerr << "wut? stype: " << stype << endl;
-                cerr << sentence_id_to_str[sentence_id] << endl;
+                cerr << key_text(sentence_id_to_str[sentence_id]) << endl;
             }
             assert(valid_theorem_counter > 0 || !is_removable_type(stype));
             outfile << valid_theorem_counter << "\n";
@@ -635,12 +928,23 @@ void save_backtrack_data() {
 
 void save_types_and_pairings_data() {
     // types_and_pairings data format
-    // S - number of sentences
+    // first line: S - number of sentences, B - number of type boundaries (N_SENTENCE_TYPES + 1),
+    //      B first ids of type blocks, NP - number of players,
+    //      NP + 1 first ids of DOES blocks of players 1..NP and end of DOES
     // next S: lines - sentence_id type_id [paired_id (if NEXT, TRUE, LEGAL or DOES)] [player_id (if LEGAL or DOES)]
     ofstream outfile(OutputPaths::types_and_pairings);
     const int S = sentence_remap.size() - count(sentence_remap.begin(), sentence_remap.end(), -1);
-    outfile << S << "\n";
-    for (size_t sentence_id = 1; sentence_id < sentence_remap.size(); ++sentence_id) {
+    outfile << S << " " << type_ranges.type_begin.size();
+    for (int begin: type_ranges.type_begin) {
+        outfile << " " << begin;
+    }
+    const int players_n = type_ranges.does_player_begin.size() - 2;
+    outfile << " " << players_n;
+    for (int player_id = 1; player_id <= players_n + 1; ++player_id) {
+        outfile << " " << type_ranges.does_player_begin[player_id];
+    }
+    outfile << "\n";
+    for (int sentence_id: sentence_order) {
         const int new_id = sentence_remap[sentence_id];
         if (new_id != -1) {
             const auto &sentence_info = sentence_infos[sentence_id];
@@ -663,26 +967,67 @@ void save_types_and_pairings_data() {
     }
 }
 
-int main(int argc, char **argv) {
-    if (argc < 3) {
-        cerr << "usage: " << argv[0] << " INPUT OUTPUT_DIR \n";
-        return 1;
+bool parse_recompress_option(int argc, char **argv, int &i, RecompressOptions &options) {
+    const string arg = argv[i];
+    if (arg == "--string-memory-budget" && i + 1 < argc) {
+        options.string_memory_budget = stoull(argv[++i]) << 20;
+    } else if (arg == "--locality-order") {
+        options.locality_order = true;
+    } else if (arg == "--profile" && i + 1 < argc) {
+        options.profile_path = argv[++i];
+    } else {
+        return false;
     }
-    input_path = argv[1];
-    string output_dir = string(argv[2]) + string("/");
+    return true;
+}
+
+void recompress(const RuleSource &rules, const string &output_path, const RecompressOptions &options) {
+    const string output_dir = output_path + "/";
+    const size_t memory_budget = options.string_memory_budget;
+    locality_order = options.locality_order;
+    profiling = !options.profile_path.empty();
     system(("mkdir -p " + output_dir).c_str());
+    // string tables are the bulk of recompressor memory, each gets half
+    sentence_id_to_str.configure(memory_budget / 2, output_dir + "sentences.spill", true);
+    theorem_id_to_str.configure(memory_budget / 2, output_dir + "theorems.spill", false);
     OutputPaths::debug_info = output_dir + OutputSuffix::DEBUG_INFO;
     OutputPaths::propnet_data = output_dir + OutputSuffix::PROPNET_DATA;
     OutputPaths::backtrack_data = output_dir + OutputSuffix::BACKTRACK_DATA;
     OutputPaths::types_and_pairings = output_dir + OutputSuffix::TYPES_AND_PAIRINGS;
 
     cerr << "COLLECTING IDS" << endl;
-    generate_ids();
-    collect_and_filter_prop_net_data();
+    profiler.start("generate_ids");
+    profiler.count("lines_in", generate_ids(rules));
+    profiler.count("sentences_out", upper_sentence_id() - 1);
+    profiler.stop();
+    collect_and_filter_prop_net_data(rules);
+
+    const long long kept_sentences = profiling ? count_kept(const_sentences) : 0;
+    const long long kept_theorems = profiling ? count_kept(const_theos) : 0;
+    const long long kept_edges = profiling ? count_kept_edges() : 0;
+    profiler.start("save_debug_info");
     save_debug_info();
+    profiler.count("sentences_out", kept_sentences);
+    profiler.count("theorems_out", kept_theorems);
+    profiler.stop();
+    profiler.start("save_propnet_data");
     save_propnet_data();
+    profiler.count("sentences_out", kept_sentences);
+    profiler.count("theorems_out", kept_theorems);
+    profiler.count("edges_out", kept_edges);
+    profiler.stop();
+    profiler.start("save_backtrack_data");
     save_backtrack_data();
+    profiler.count("sentences_out", kept_sentences);
+    profiler.count("theorems_out", kept_theorems);
+    profiler.stop();
+    profiler.start("save_types_and_pairings_data");
     save_types_and_pairings_data();
+    profiler.count("sentences_out", kept_sentences);
+    profiler.stop();
+    if (!options.profile_path.empty()) {
+        profiler.save_json(options.profile_path);
+    }
 
     // filter out const sentences and theorems
     // split by:
@@ -694,6 +1039,4 @@ int main(int argc, char **argv) {
     // * terminal
     // * goal
     // * init
-    
-    return 0;
 }
@@ -1,4 +1,9 @@
 #pragma once
+#include <vector>
+#include <string>
+#include <functional>
+
+using namespace std;
 
 namespace SENTENCE_TYPE {
     enum {
@@ -44,6 +49,44 @@ struct SentenceInfo {
     // backtrack deps
 };
 
+// The recompressor numbers sentences in blocks, one block per type in
+// SENTENCE_TYPE order. DOES are grouped by player and LEGAL, NEXT blocks
+// follow the order of DOES, TRUE blocks, so equivalent ids of those
+// sentences differ by a fixed offset.
+struct SentenceTypeRanges {
+    vector<int> type_begin; // N_SENTENCE_TYPES + 1 ids, empty if unknown
+    vector<int> does_player_begin; // index = player_id, last = end of DOES
+
+    bool known() const {
+        return !type_begin.empty();
+    }
+
+    int begin(int sentence_type) const {
+        return type_begin[sentence_type];
+    }
+
+    int end(int sentence_type) const {
+        return type_begin[sentence_type + 1];
+    }
+
+    bool contains(int sentence_type, int sentence_id) const {
+        return sentence_id >= begin(sentence_type) && sentence_id < end(sentence_type);
+    }
+
+    // NEXT, LEGAL, TERMINAL and GOAL - everything reported by Propnet::run
+    int reported_begin() const {
+        return begin(SENTENCE_TYPE::NEXT);
+    }
+
+    int reported_end() const {
+        return end(SENTENCE_TYPE::GOAL);
+    }
+
+    int true_to_next_offset() const {
+        return begin(SENTENCE_TYPE::NEXT) - begin(SENTENCE_TYPE::TRUE);
+    }
+};
+
 inline bool is_input_type(int sentence_type) {
     // can't be on left side of any theorem 
     return sentence_type == SENTENCE_TYPE::TRUE || sentence_type == SENTENCE_TYPE::DOES;
@@ -72,3 +115,41 @@ inline bool is_with_player_type(int sentence_type) {
     return sentence_type == SENTENCE_TYPE::LEGAL ||
            sentence_type == SENTENCE_TYPE::DOES;
 }
+
+
+struct HighNode;
+// A source calls visit(rule) for every ground theorem. The recompressor
+// goes through its source twice.
+typedef function<void(HighNode &rule)> RuleVisitor;
+typedef function<void(const RuleVisitor &visit)> RuleSource;
+
+// theorems of a reprinted file, one per line, visited in file order while
+// threads_n threads tokenize the next chunks of the file
+RuleSource rule_file_source(const string &path, int threads_n=1);
+
+struct RecompressOptions {
+    // bytes of sentence and theorem strings kept in memory, 0 - no limit
+    size_t string_memory_budget;
+    string profile_path;
+    bool locality_order;
+    RecompressOptions() {
+        string_memory_budget = 0;
+        locality_order = false;
+    }
+};
+
+const char *const RECOMPRESS_OPTIONS_USAGE =
+    "  --string-memory-budget MB - keep at most MB megabytes of sentence\n"
+    "                       and theorem strings in memory, spill the rest\n"
+    "                       to temporary files in OUTPUT_DIR; theorem\n"
+    "                       bodies and the propagation graph stay in\n"
+    "                       memory whatever the budget\n"
+    "  --profile PATH     - save per phase time, memory and size\n"
+    "                       metrics as JSON to PATH\n"
+    "  --locality-order   - number sentences and theorems in breadth\n"
+    "                       first order of the propagation graph\n";
+
+// parses argv[i] and its value, false if it isn't a recompressor option
+bool parse_recompress_option(int argc, char **argv, int &i, RecompressOptions &options);
+// saves the four recompressor files to output_dir, once per process
+void recompress(const RuleSource &rules, const string &output_dir, const RecompressOptions &options);
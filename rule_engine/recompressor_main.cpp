@@ -0,0 +1,40 @@
+#include <iostream>
+#include <string>
+
+#ifndef NO_BACKWARD
+#define BACKWARD_HAS_DW 1
+#include "backward.hpp"
+
+namespace backward {
+    backward::SignalHandling sh;
+};
+
+#endif
+
+
+using namespace std;
+#include "recompressor.hpp"
+
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " INPUT OUTPUT_DIR [--string-memory-budget MB] [--profile PATH]\n"
+                "       [--locality-order] [--threads N]\n";
+        cerr << RECOMPRESS_OPTIONS_USAGE;
+        cerr << "  --threads N        - tokenize INPUT on N threads ahead of\n"
+                "                       the recompressor\n";
+        return 1;
+    }
+    RecompressOptions options;
+    int threads_n = 1;
+    for (int i = 3; i < argc; ++i) {
+        if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads_n = max(1, atoi(argv[++i]));
+        } else if (!parse_recompress_option(argc, argv, i, options)) {
+            cerr << "unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+    recompress(rule_file_source(argv[1], threads_n), argv[2], options);
+    return 0;
+}
@@ -2,9 +2,10 @@
 #include <vector>
 #include <algorithm>
 #include <fstream>
-#include <regex>
 #include <unordered_set>
 #include "GDLTokenizer.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
 
 #ifndef NO_BACKWARD
 #define BACKWARD_HAS_DW 1
@@ -18,31 +19,97 @@ namespace backward {
 
 
 using namespace std;
+
+static bool same_term(const FlatGDLTokens &tokens, int a, int b) {
+    const auto &na = tokens.nodes[a];
+    const auto &nb = tokens.nodes[b];
+    if (na.children_n != nb.children_n) {
+        return false;
+    }
+    if (na.children_n == 0) {
+        return na.length == nb.length
+            && tokens.input.compare(na.offset, na.length, tokens.input, nb.offset, nb.length) == 0;
+    }
+    for (a = na.first_child, b = nb.first_child; a != -1; a = tokens.nodes[a].next_sibling,
+            b = tokens.nodes[b].next_sibling) {
+        if (!same_term(tokens, a, b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a ( distinct X X ) anywhere in the rule, X is a name or a whole list
+static bool has_equal_distinct(const FlatGDLTokens &tokens) {
+    for (const auto &node: tokens.nodes) {
+        if (node.children_n != 3 || !tokens.name_is(node.first_child, "distinct")) continue;
+        const int first = tokens.nodes[node.first_child].next_sibling;
+        if (same_term(tokens, first, tokens.nodes[first].next_sibling)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Prints every rule of a file with one rule per line as to_nice_string
+// would, without base and input rules and rules with distinct X X, each
+// text once, sorted. Chunks of the mapped file are tokenized and printed
+// on the pool, a few per thread at a time. Each chunk deduplicates its
+// texts, then they are merged into the printed ones before the next batch.
 int main(int argc, char **argv) {
-    smatch reg_mach;
-    regex reg_exp(" distinct ([^[:space:]]+) \\1");
+    const size_t CHUNK_BYTES = 1 << 20;
     if (argc < 3) {
-        cerr << "usage: " << argv[0] << " INPUT OUTPUT\n";
+        cerr << "usage: " << argv[0] << " INPUT OUTPUT [--threads N]\n";
         return 1;
     }
+    int threads_n = 1;
+    if (argc > 4 && string(argv[3]) == "--threads") {
+        threads_n = max(1, atoi(argv[4]));
+    }
+    const MappedFile input(argv[1]);
+    const auto bounds = line_chunk_bounds(input, CHUNK_BYTES);
+    const int chunks_n = bounds.size() - 1;
+    ThreadPool pool(threads_n);
+    const int batch_chunks = pool.size() * 4;
+    vector<unordered_set<string>> chunk_texts(batch_chunks);
+    // printed texts are kept once, in lines, the set holds their indexes
     vector<string> lines;
-    unordered_set<string> already_printed;
-    GDLToken token;
-    ifstream inpf(argv[1]);
-    string line;
-    while (getline(inpf, line)) {
-        GDLTokenizer::tokenize_str(line, token);
-        string nice_string = token.to_nice_string();
-        if (nice_string.find("base") != string::npos) continue;
-        if (nice_string.find("input") != string::npos) continue;
-        // warning - it will produce wrong output if there is something like not (distinct X X)
-        if (regex_search(nice_string, reg_mach, reg_exp) // remove distinct X X
-                || already_printed.count(nice_string) > 0) {
-            continue;
+    auto line_hash = [&lines](int i) { return hash<string>()(lines[i]); };
+    auto line_equal = [&lines](int a, int b) { return lines[a] == lines[b]; };
+    unordered_set<int, decltype(line_hash), decltype(line_equal)>
+        already_printed(0, line_hash, line_equal);
+    auto print_chunk = [&](int chunk, unordered_set<string> &texts) {
+        FlatGDLTokens tokens;
+        string nice_string;
+        for_each_line(input.data + bounds[chunk], input.data + bounds[chunk + 1],
+                [&](const char *line, size_t length) {
+            tokens.input.assign(line, length);
+            tokens.tokenize();
+            nice_string.clear();
+            tokens.append_nice_string(nice_string);
+            if (nice_string.find("base") != string::npos) return;
+            if (nice_string.find("input") != string::npos) return;
+            // warning - it will produce wrong output if there is something like not (distinct X X)
+            if (has_equal_distinct(tokens)) return; // remove distinct X X
+            texts.insert(nice_string + "\n");
+        });
+    };
+    for (int batch_begin = 0; batch_begin < chunks_n; batch_begin += batch_chunks) {
+        const int batch_n = min(batch_chunks, chunks_n - batch_begin);
+        pool.run(batch_n, [&](int i, int) {
+            print_chunk(batch_begin + i, chunk_texts[i]);
+        });
+        for (int i = 0; i < batch_n; ++i) {
+            for (const auto &text: chunk_texts[i]) {
+                lines.push_back(text);
+                if (!already_printed.insert(lines.size() - 1).second) {
+                    lines.pop_back();
+                }
+            }
+            unordered_set<string>().swap(chunk_texts[i]);
         }
-        already_printed.insert(nice_string);
-        lines.push_back(nice_string + "\n");
     }
+    already_printed.clear();
     sort(lines.begin(), lines.end());
     ofstream output(argv[2]);
     for (const auto &line: lines) {
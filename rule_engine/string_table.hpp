@@ -0,0 +1,168 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+#include "common.hpp"
+
+// Append-only table of strings addressed by consecutive ids.
+// Strings stay in memory until they take more than memory_budget bytes,
+// then all of them are moved to a spill file and read back on demand.
+// Spilled strings are stored in id order, for_each_string reads them in
+// one sequential pass, operator[] seeks for every string.
+// An indexed table also keeps a fingerprint of every string, so find
+// reads a spilled string back only when both its hash and its fingerprint
+// match.
+struct StringTable {
+    vector<string> in_memory; // strings with ids >= spilled_n
+    vector<long long> spill_offsets; // spilled_n + 1 offsets into spill file
+    size_t spilled_n;
+    size_t in_memory_bytes;
+    size_t memory_budget; // 0 - never spill
+    string spill_path;
+    FILE *spill_file;
+
+    bool indexed;
+    unordered_multimap<size_t, int> index; // hash of string -> id
+    vector<uint64_t> fingerprints; // by id, independent of the index hash
+
+    StringTable() {
+        spilled_n = 0;
+        in_memory_bytes = 0;
+        memory_budget = 0;
+        spill_file = 0;
+        indexed = false;
+        spill_offsets.push_back(0);
+    }
+
+    ~StringTable() {
+        if (spill_file) {
+            fclose(spill_file);
+        }
+    }
+
+    void configure(size_t _memory_budget, const string &_spill_path, bool _indexed) {
+        assert(size() == 0);
+        memory_budget = _memory_budget;
+        spill_path = _spill_path;
+        indexed = _indexed;
+    }
+
+    size_t size() const {
+        return spilled_n + in_memory.size();
+    }
+
+    int push_back(const string &s) {
+        const int id = size();
+        if (indexed) {
+            index.insert(make_pair(str_hasher(s), id));
+            fingerprints.push_back(fingerprint(s));
+        }
+        in_memory.push_back(s);
+        in_memory_bytes += s.size() + sizeof(string);
+        if (memory_budget > 0 && in_memory_bytes > memory_budget) {
+            spill();
+        }
+        return id;
+    }
+
+    // returns -1 if s is not in the table
+    int find(const string &s) const {
+        assert(indexed);
+        auto range = index.equal_range(str_hasher(s));
+        if (range.first == range.second) {
+            return -1;
+        }
+        const uint64_t s_fingerprint = fingerprint(s);
+        for (auto it = range.first; it != range.second; ++it) {
+            const size_t id = it->second;
+            if (fingerprints[id] != s_fingerprint) {
+                continue;
+            }
+            if (id < spilled_n ? spilled_equals(id, s) : in_memory[id - spilled_n] == s) {
+                return id;
+            }
+        }
+        return -1;
+    }
+
+    bool spilled_equals(size_t id, const string &s) const {
+        assert(id < spilled_n);
+        if ((size_t)(spill_offsets[id + 1] - spill_offsets[id]) != s.size()) {
+            return false;
+        }
+        return (*this)[id] == s;
+    }
+
+    // FNV-1a, 64 bits
+    static uint64_t fingerprint(const string &s) {
+        uint64_t res = 14695981039346656037ULL;
+        for (unsigned char c: s) {
+            res = (res ^ c) * 1099511628211ULL;
+        }
+        return res;
+    }
+
+    // calls visit(id, string) for all strings in id order
+    template <typename Visit>
+    void for_each_string(Visit visit) const {
+        string s;
+        if (spilled_n > 0) {
+            fseeko(spill_file, 0, SEEK_SET);
+        }
+        for (size_t id = 0; id < spilled_n; ++id) {
+            s.resize(spill_offsets[id + 1] - spill_offsets[id]);
+            size_t read_n = fread(&s[0], 1, s.size(), spill_file);
+            assert(read_n == s.size());
+            (void)read_n;
+            visit(id, s);
+        }
+        for (size_t i = 0; i < in_memory.size(); ++i) {
+            visit(spilled_n + i, in_memory[i]);
+        }
+    }
+
+    string operator[](size_t id) const {
+        assert(id < size());
+        if (id >= spilled_n) {
+            return in_memory[id - spilled_n];
+        }
+        const long long offset = spill_offsets[id];
+        string res(spill_offsets[id + 1] - offset, '\0');
+        fseeko(spill_file, offset, SEEK_SET);
+        size_t read_n = fread(&res[0], 1, res.size(), spill_file);
+        assert(read_n == res.size());
+        (void)read_n;
+        return res;
+    }
+
+    void spill() {
+        if (!spill_file) {
+            spill_file = fopen(spill_path.c_str(), "w+b");
+            if (!spill_file) {
+                throw runtime_error("can't create spill file: " + spill_path);
+            }
+            // file stays accessible through spill_file until it is closed
+            remove(spill_path.c_str());
+        }
+        fseeko(spill_file, 0, SEEK_END);
+        for (const auto &s: in_memory) {
+            fwrite(s.data(), 1, s.size(), spill_file);
+            spill_offsets.push_back(spill_offsets.back() + s.size());
+        }
+        fflush(spill_file);
+        spilled_n += in_memory.size();
+        assert(spill_offsets.size() == spilled_n + 1);
+        in_memory.clear();
+        in_memory.shrink_to_fit();
+        in_memory_bytes = 0;
+        cerr << "spilled " << spilled_n << " strings to " << spill_path << endl;
+    }
+};
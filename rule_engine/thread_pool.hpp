@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+// Fixed set of threads running batches of indexed tasks.
+// The calling thread works too, so ThreadPool(1) runs everything inline.
+struct ThreadPool {
+    vector<thread> workers;
+    mutex m;
+    condition_variable batch_started, batch_done;
+    function<void(int, int)> job; // job(task, worker), worker in [0, size())
+    int tasks_n;
+    atomic<int> next_task;
+    int running_workers;
+    size_t batch_id;
+    bool stopping;
+
+    ThreadPool(int threads_n) {
+        tasks_n = 0;
+        next_task = 0;
+        running_workers = 0;
+        batch_id = 0;
+        stopping = false;
+        for (int worker = 1; worker < threads_n; ++worker) {
+            workers.emplace_back(&ThreadPool::worker_loop, this, worker);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        batch_started.notify_all();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    int size() const {
+        return workers.size() + 1;
+    }
+
+    // returns when all tasks are done
+    void run(int _tasks_n, function<void(int, int)> _job) {
+        {
+            lock_guard<mutex> lock(m);
+            job = _job;
+            tasks_n = _tasks_n;
+            next_task = 0;
+            running_workers = workers.size();
+            ++batch_id;
+        }
+        batch_started.notify_all();
+        work(0);
+        unique_lock<mutex> lock(m);
+        batch_done.wait(lock, [this]() { return running_workers == 0; });
+    }
+
+private:
+    void work(int worker) {
+        while (true) {
+            const int task = next_task++;
+            if (task >= tasks_n) break;
+            job(task, worker);
+        }
+    }
+
+    void worker_loop(int worker) {
+        size_t done_batch_id = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(m);
+                batch_started.wait(lock, [this, done_batch_id]() {
+                    return stopping || batch_id != done_batch_id;
+                });
+                if (stopping) return;
+                done_batch_id = batch_id;
+            }
+            work(worker);
+            {
+                lock_guard<mutex> lock(m);
+                if (--running_workers == 0) {
+                    batch_done.notify_one();
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#ifndef NO_BACKWARD
+#define BACKWARD_HAS_DW 1
+#include "backward.hpp"
+
+namespace backward {
+    backward::SignalHandling sh;
+};
+
+#endif
+
+using namespace std;
+#include "GDLTokenizer.hpp"
+
+// Parse throughput of the tokenizers on a file with one rule per line
+// (a flattened game), the way the reprinter reads it: every line is
+// tokenized and printed back with to_nice_string. Then whole file loads
+// into GDLTokens, by tokenize and by optimized_tokenize on threads.
+
+static size_t text_hash(size_t h, const string &s) {
+    return h * 1000003 ^ hash<string>()(s);
+}
+
+// runs parse_line on every line repetitions times, reports MB/s,
+// returns a hash of the printed lines
+static size_t measure(const string &name, const vector<string> &lines, size_t bytes,
+        int repetitions, function<void(const string&, string&)> parse_line) {
+    size_t res = 0;
+    string printed;
+    const auto started = chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; ++r) {
+        res = 0;
+        for (const auto &line: lines) {
+            parse_line(line, printed);
+            res = text_hash(res, printed);
+        }
+    }
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cerr << name << ": " << seconds / repetitions << " s, "
+        << bytes * repetitions / seconds / (1 << 20) << " MB/s" << endl;
+    return res;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " INPUT [REPETITIONS [THREADS]]\n"
+                "  INPUT - one rule per line, like the output of flatten" << endl;
+        return 1;
+    }
+    const int repetitions = argc > 2 ? max(1, atoi(argv[2])) : 3;
+    const int threads_n = argc > 3 ? max(1, atoi(argv[3])) : thread::hardware_concurrency();
+    ifstream inp(argv[1]);
+    if (!inp) {
+        throw runtime_error("can't open file: " + string(argv[1]));
+    }
+    vector<string> lines;
+    size_t bytes = 0;
+    string line;
+    while (getline(inp, line)) {
+        bytes += line.size() + 1;
+        lines.push_back(line);
+    }
+    cerr << "lines: " << lines.size() << ", " << bytes << " bytes" << endl;
+
+    GDLToken token;
+    const size_t tree = measure("GDLToken tree", lines, bytes, repetitions,
+            [&token](const string &line, string &printed) {
+        GDLTokenizer::tokenize_str_by_tree(line, token);
+        printed = token.to_nice_string();
+    });
+    const size_t adapter = measure("flat via GDLToken", lines, bytes, repetitions,
+            [&token](const string &line, string &printed) {
+        GDLTokenizer::tokenize_str(line, token);
+        printed = token.to_nice_string();
+    });
+    FlatGDLTokens tokens;
+    const size_t flat = measure("flat", lines, bytes, repetitions,
+            [&tokens](const string &line, string &printed) {
+        tokens.tokenize_str(line);
+        printed.clear();
+        tokens.append_nice_string(printed);
+    });
+    if (tree != adapter || tree != flat) {
+        cerr << "tokenizers print different texts" << endl;
+        return 1;
+    }
+
+    // whole file loads, timed without hashing the tokens
+    vector<size_t> loaded;
+    for (int load_threads_n: {0, 1, threads_n}) {
+        double seconds = 0;
+        size_t res = 0;
+        for (int r = 0; r < repetitions; ++r) {
+            vector<GDLToken> tokens;
+            const auto started = chrono::steady_clock::now();
+            if (load_threads_n == 0) {
+                GDLTokenizer::tokenize(argv[1], tokens);
+            } else {
+                GDLTokenizer::optimized_tokenize(argv[1], tokens, load_threads_n);
+            }
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            res = 0;
+            for (const auto &token: tokens) {
+                res = text_hash(res, token.to_nice_string());
+            }
+        }
+        cerr << (load_threads_n == 0 ? string("tokenize")
+                : "optimized_tokenize, " + to_string(load_threads_n) + " threads")
+            << ": " << seconds / repetitions << " s, "
+            << bytes * repetitions / seconds / (1 << 20) << " MB/s" << endl;
+        loaded.push_back(res);
+    }
+    if (loaded[0] != tree || loaded[1] != tree || loaded[2] != tree) {
+        cerr << "loaders give different tokens" << endl;
+        return 1;
+    }
+    return 0;
+}
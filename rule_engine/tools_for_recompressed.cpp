@@ -1,4 +1,5 @@
 #include "tools_for_recompressed.hpp"
+#include <sstream>
 
 static int _identity_mapper(int x) {
     return x;
@@ -22,13 +23,36 @@ function<int(int)> consensus_mapper_generator(
 }
 
 void load_sentence_infos(
-        const string &input_path, function<int(int)> mapper, vector<SentenceInfo> &sentence_infos) {
+        const string &input_path, function<int(int)> mapper, vector<SentenceInfo> &sentence_infos,
+        SentenceTypeRanges *type_ranges) {
     ifstream inf(input_path);
     if (!inf) {
         throw runtime_error("file: " + input_path + " does not exist.");
     }
     int n_sentences;
-    inf >> n_sentences;
+    string header;
+    getline(inf, header);
+    istringstream header_stream(header);
+    header_stream >> n_sentences;
+    if (type_ranges) {
+        // older files have only number of sentences in header
+        type_ranges->type_begin.resize(0);
+        type_ranges->does_player_begin.resize(0);
+        int n_bounds, n_players;
+        if (header_stream >> n_bounds) {
+            assert(n_bounds == SENTENCE_TYPE::N_SENTENCE_TYPES + 1);
+            type_ranges->type_begin.resize(n_bounds);
+            for (auto &begin: type_ranges->type_begin) {
+                header_stream >> begin;
+            }
+            header_stream >> n_players;
+            type_ranges->does_player_begin.resize(n_players + 2);
+            type_ranges->does_player_begin[0] = type_ranges->begin(SENTENCE_TYPE::DOES);
+            for (int player_id = 1; player_id <= n_players + 1; ++player_id) {
+                header_stream >> type_ranges->does_player_begin[player_id];
+            }
+        }
+    }
     sentence_infos.resize(0);
     sentence_infos.resize(n_sentences + 1);
     for (int it = 1; it <= n_sentences; ++it) {
@@ -41,6 +65,7 @@ void load_sentence_infos(
         inf >> to_fill.type;
         if (is_with_equivalent_type(to_fill.type)) {
             inf >> to_fill.equivalent_id;
+            to_fill.equivalent_id = mapper(to_fill.equivalent_id);
         } else {
             to_fill.equivalent_id = -1;
         }
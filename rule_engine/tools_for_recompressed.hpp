@@ -13,8 +13,11 @@ using namespace std;
 #include "recompressor.hpp"
 #include "common.hpp"
 
+// type_ranges are filled if they are stored in the file and requested,
+// they are valid only for identity mapper
 void load_sentence_infos(const string &input_path, function<int(int)> mapper,
-                         vector<SentenceInfo> &sentence_infos);
+                         vector<SentenceInfo> &sentence_infos,
+                         SentenceTypeRanges *type_ranges=0);
 
 struct BacktrackData {
     struct SentenceHook {
@@ -116,6 +119,48 @@ struct BacktrackData {
 };
 
 
+namespace DEPS_ENCODING {
+    enum {
+        PLAIN, // one int per dependency
+        PACKED, // sorted ids as zigzag first id and varint deltas
+    };
+};
+
+// Decoder of deps packed by PropnetData with DEPS_ENCODING::PACKED.
+struct PackedDepsDecoder {
+    const unsigned char *p;
+    int last;
+
+    PackedDepsDecoder(const unsigned char *_p) {
+        p = _p;
+        last = 0;
+    }
+
+    unsigned int read_varint() {
+        unsigned int res = *p++;
+        if (res < 0x80) return res;
+        res &= 0x7f;
+        int shift = 7;
+        while (true) {
+            const unsigned int byte = *p++;
+            res |= (byte & 0x7f) << shift;
+            if (byte < 0x80) return res;
+            shift += 7;
+        }
+    }
+
+    int first() {
+        const unsigned int zigzag = read_varint();
+        last = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+        return last;
+    }
+
+    int next() {
+        last += read_varint();
+        return last;
+    }
+};
+
 struct PropnetData {
     // TODO: remember to prepare TheoremHook counter values run "ALL FALSE" first propagation
 
@@ -175,7 +220,7 @@ struct PropnetData {
     };
 
     struct SentenceHook: GateCounter {
-        int offset;
+        int offset; // index in deps_data or packed_deps depending on deps_encoding
         int n_deps;
         int value; // -1 - undecided, 0 - false, 1 - true;
         SentenceHook() {
@@ -194,7 +239,53 @@ struct PropnetData {
 
     vector<TheoremHook> theorem_hooks;
     vector<SentenceHook> sentence_hooks;
+    int deps_encoding;
     vector<int> deps_data;
+    vector<unsigned char> packed_deps;
+
+    PropnetData() {
+        deps_encoding = DEPS_ENCODING::PLAIN;
+    }
+
+    // calls f(signed theorem id) for every dependency of the sentence
+    template <typename F>
+    void for_each_dep(const SentenceHook &shook, F f) const {
+        if (deps_encoding == DEPS_ENCODING::PLAIN) {
+            const int *deps = deps_data.data() + shook.offset;
+            for (int i = 0; i < shook.n_deps; ++i) {
+                f(deps[i]);
+            }
+        } else {
+            if (shook.n_deps == 0) return;
+            PackedDepsDecoder decoder(packed_deps.data() + shook.offset);
+            f(decoder.first());
+            for (int i = 1; i < shook.n_deps; ++i) {
+                f(decoder.next());
+            }
+        }
+    }
+
+    size_t deps_memory_bytes() const {
+        return deps_data.capacity() * sizeof(int) + packed_deps.capacity();
+    }
+
+    void append_varint(unsigned int x) {
+        while (x >= 0x80) {
+            packed_deps.push_back((x & 0x7f) | 0x80);
+            x >>= 7;
+        }
+        packed_deps.push_back(x);
+    }
+
+    void pack_deps(const int *deps, int n_deps) {
+        // deps are sorted, so all deltas after the first id are non-negative
+        if (n_deps == 0) return;
+        append_varint(((unsigned int)deps[0] << 1) ^ (unsigned int)(deps[0] >> 31));
+        for (int i = 1; i < n_deps; ++i) {
+            assert(deps[i] >= deps[i - 1]);
+            append_varint(deps[i] - deps[i - 1]);
+        }
+    }
 
     bool operator==(const PropnetData &pd) const {
         if (pd.theorem_hooks.size() != theorem_hooks.size() ||
@@ -213,18 +304,22 @@ struct PropnetData {
             if (shook1.n_deps != shook2.n_deps) {
                 return false;
             }
-            for (int i = 0; i < shook1.n_deps; ++i) {
-                if (deps_data[shook1.offset + i] != pd.deps_data[shook2.offset + i]) {
-                    return false;
-                }
+            vector<int> deps1, deps2;
+            for_each_dep(shook1, [&deps1](int dep) { deps1.push_back(dep); });
+            pd.for_each_dep(shook2, [&deps2](int dep) { deps2.push_back(dep); });
+            if (deps1 != deps2) {
+                return false;
             }
         }
         return true;
     }
 
-    void load(const string &input_path, function<int(int)> smapper, function<int(int)>tmapper) {
+    void load(const string &input_path, function<int(int)> smapper, function<int(int)>tmapper,
+              int _deps_encoding=DEPS_ENCODING::PLAIN) {
         theorem_hooks.resize(0);
         deps_data.resize(0);
+        packed_deps.resize(0);
+        deps_encoding = _deps_encoding;
         int n_sentences, n_theorems;
         ifstream inp(input_path);
         if (!inp) {
@@ -265,6 +360,16 @@ struct PropnetData {
                 sort(&deps_data[0] + to_fill.offset, 
                      &deps_data[0] + to_fill.offset + to_fill.n_deps);
             }
+            if (deps_encoding == DEPS_ENCODING::PACKED) {
+                const int sentence_deps_offset = to_fill.offset;
+                to_fill.offset = packed_deps.size();
+                pack_deps(deps_data.data() + sentence_deps_offset, to_fill.n_deps);
+                deps_data.resize(0);
+            }
+        }
+        if (deps_encoding == DEPS_ENCODING::PACKED) {
+            deps_data.shrink_to_fit();
+            packed_deps.shrink_to_fit();
         }
     }
 };
@@ -17,8 +17,18 @@ flat_prefix = {
 err_suffix = ".stderr"
 out_suffix = ".stdout"
 
+# options of opt_flatten which must not change its output
+opt_variants = [
+    ('threads', '--threads 4'),
+    ('trie', '--join trie'),
+    ('plan', '--plan'),
+    ('generic', '--generic-join'),
+]
+# exit code of flatten stopped by --ground-memory-budget
+EXIT_OVER_MEMORY_BUDGET = 3
+
 input_types = [
-    #('amazons', ['opt', 'dbg']),
+    ('amazons', ['opt', 'dbg']),
     ('amazons_8x8', ['sancho', 'opt', 'dbg']),
     ('breakthrough', ['sancho', 'opt', 'dbg']),
     ('breakthroughSmall', ['sancho', 'opt', 'dbg']),
@@ -56,9 +66,68 @@ def super_iterator(to_iterate):
 def outname(input_name, flattener_name):
     return output_dir + flat_prefix[flattener_name] + input_name
 
-def reprinted_outname(input_name, flattener_name):
-    return (output_dir + reprinted_prefix + 
-            flat_prefix[flattener_name] + input_name)
+def flatten(cmd_prefix, inpf, out_flat, args=""):
+    run_cmd_fail("time timeout %s %s %s %s %s > %s 2> %s" % (
+        TIMEOUT_SECONDS, cmd_prefix, inpf, out_flat, args,
+        out_flat + out_suffix, out_flat + err_suffix)
+    )
+
+
+def reprint(out_flat):
+    reprintedf = output_dir + reprinted_prefix + os.path.basename(out_flat)
+    run_cmd_fail("./rule_engine/reprinter %s %s" % (out_flat, reprintedf))
+    run_cmd_fail("mv %s %s" % (reprintedf, out_flat))
+
+
+def check_opt_variants(inpfn, out_simpl):
+    for variant, args in opt_variants:
+        out_variant = output_dir + 'opt_' + variant + '_flat_' + inpfn
+        flatten("./rule_engine/opt_flatten", out_simpl, out_variant, args)
+        reprint(out_variant)
+        if run_cmd("diff %s %s" % (outname(inpfn, 'opt'), out_variant)):
+            raise Exception("opt with %s different than opt!" % args)
+
+
+def recompress(out_flat):
+    out_dir = out_flat + '_recompressed'
+    run_cmd_fail("rm -rf %s" % out_dir)
+    run_cmd_fail("./rule_engine/recompressor %s %s > %s 2> %s" % (
+        out_flat, out_dir, out_dir + out_suffix, out_dir + err_suffix))
+    return out_dir
+
+
+def check_relevant_only(inpfn, out_simpl):
+    # pruned rules print fewer lines, so the propnets are compared
+    out_relevant = output_dir + 'opt_relevant_flat_' + inpfn
+    flatten("./rule_engine/opt_flatten", out_simpl, out_relevant, "--relevant-only")
+    reprint(out_relevant)
+    run_cmd_fail("./rule_engine/recom_cmp %s %s" % (
+        recompress(outname(inpfn, 'opt')), recompress(out_relevant)))
+
+
+def check_checkpoint(inpfn, out_simpl):
+    # stops at 1 MB with a checkpoint, resuming without the budget
+    # has to give the output of a full run
+    out_resumed = output_dir + 'opt_resumed_flat_' + inpfn
+    checkpoint = out_resumed + '.checkpoint'
+    run_cmd_fail("rm -f %s %s.partial" % (checkpoint, out_resumed))
+    exit_code = run_cmd("timeout %s ./rule_engine/opt_flatten %s %s --ground-memory-budget 1 "
+        "--checkpoint %s > %s 2> %s" % (
+            TIMEOUT_SECONDS, out_simpl, out_resumed, checkpoint,
+            out_resumed + out_suffix, out_resumed + err_suffix)) >> 8
+    if exit_code == 0:
+        print "grounding fits in 1 MB, nothing to resume"
+    elif exit_code != EXIT_OVER_MEMORY_BUDGET:
+        raise Exception("opt with --ground-memory-budget 1 exited with %d" % exit_code)
+    else:
+        for path in [out_resumed + '.partial', checkpoint]:
+            if not os.path.isfile(path):
+                raise Exception("%s not written when over memory budget" % path)
+        flatten("./rule_engine/opt_flatten", out_simpl, out_resumed,
+                "--checkpoint %s --resume" % checkpoint)
+    reprint(out_resumed)
+    if run_cmd("diff %s %s" % (outname(inpfn, 'opt'), out_resumed)):
+        raise Exception("opt resumed from checkpoint different than opt!")
 
 
 def main():
@@ -78,21 +147,18 @@ def main():
         run_cmd_fail("./rule_engine/reprinter %s %s" % (out_sancho_simpl, out_simpl))
         for flattener in flatteners:
             out_flat = outname(inpfn, flattener)
-            stdoutf = out_flat + out_suffix
-            stderrf = out_flat + err_suffix
-            reprintedf = reprinted_outname(inpfn, flattener)
             if flattener == "sancho":
                 cmd_prefix = "python flatten_by_sancho.py"
             if flattener == "opt":
                 cmd_prefix = "./rule_engine/opt_flatten"
             if flattener == "dbg":
                 cmd_prefix = "./rule_engine/flatten"
-            run_cmd_fail("time timeout %s %s %s %s > %s 2> %s" % (
-                TIMEOUT_SECONDS, cmd_prefix, out_simpl, 
-                out_flat, stdoutf, stderrf)
-            )
-            run_cmd_fail("./rule_engine/reprinter %s %s" % (out_flat, reprintedf))
-            run_cmd_fail("mv %s %s" % (reprintedf, out_flat))
+            flatten(cmd_prefix, out_simpl, out_flat)
+            reprint(out_flat)
+        if 'opt' in flatteners:
+            check_opt_variants(inpfn, out_simpl)
+            check_relevant_only(inpfn, out_simpl)
+            check_checkpoint(inpfn, out_simpl)
         if len(flatteners) <= 2:
             assert set(['opt', 'dbg']).issubset(set(flatteners))
             if run_cmd("diff %s %s" % (outname(inpfn, 'opt'), outname(inpfn, 'dbg'))):
@@ -14,6 +14,10 @@ COMMAND_CHAIN = [
     ("time ./rule_engine/recompressor {0} {1} >{2} 2>{3}", "recompressed"),
 ]
 
+# flattens and recompresses first_reprinted in one process,
+# the result has to be equivalent to recompressed
+FUSED_COMMAND = "time ./rule_engine/ground_and_compile {0} {1} >{2} 2>{3}"
+
 def run_cmd(cmd_s):
     print cmd_s
     return os.system(cmd_s)
@@ -55,6 +59,11 @@ def main():
                     cmd_stdout, cmd_stderr)
             run_cmd_fail(cmd)
             cmd_input = cmd_output
+        fused_output = out_dir + 'fused'
+        run_cmd_fail(FUSED_COMMAND.format(
+                out_dir + 'first_reprinted', fused_output,
+                fused_output + '.stdout', fused_output + '.stderr'))
+        run_cmd_fail("./rule_engine/recom_cmp %s %s" % (out_dir + 'recompressed', fused_output))
 
 
 if __name__ == '__main__':